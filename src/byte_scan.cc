@@ -0,0 +1,351 @@
+#include "byte_scan.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace oned {
+
+static constexpr size_t npos = std::string_view::npos;
+
+static uint64_t count_byte_scalar(const char *data, size_t size, char byte) {
+  return std::count(data, data + size, byte);
+}
+
+// glibc's memchr already picks the widest vectors the CPU has and beats a
+// hand-rolled loop, every kernel set shares it.
+static size_t find_byte_scalar(const char *data, size_t size, char byte) {
+  const auto *p = static_cast<const char *>(std::memchr(data, byte, size));
+  return p == nullptr ? npos : p - data;
+}
+
+static size_t find_substring_scalar(const char *data, size_t size,
+                                    const char *needle, size_t needle_size) {
+  return std::string_view(data, size).find(
+      std::string_view(needle, needle_size));
+}
+
+static size_t find_nth_byte_scalar(const char *data, size_t size, char byte,
+                                   uint64_t &n) {
+  size_t pos = 0;
+  while (n != 0) {
+    auto found = find_byte_scalar(data + pos, size - pos, byte);
+    if (found == npos) {
+      return npos;
+    }
+    pos += found + 1;
+    if (--n == 0) {
+      return pos - 1;
+    }
+  }
+  return npos;
+}
+
+// Position of the n-th (from 1) set bit, n must not exceed popcount(mask).
+static unsigned nth_bit(uint64_t mask, uint64_t n) {
+  while (--n != 0) {
+    mask &= mask - 1;
+  }
+  return std::countr_zero(mask);
+}
+
+static constexpr ByteKernels kScalarKernels{
+    .name = "scalar",
+    .count_byte = count_byte_scalar,
+    .find_byte = find_byte_scalar,
+    .find_substring = find_substring_scalar,
+    .find_nth_byte = find_nth_byte_scalar,
+};
+
+#if defined(__x86_64__)
+
+// SSE2 is part of x86-64, so this one needs no runtime check.
+
+static inline __m128i load16(const char *p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));  // NOLINT
+}
+
+static uint64_t count_byte_sse2(const char *data, size_t size, char byte) {
+  auto needle = _mm_set1_epi8(byte);
+  uint64_t count = 0;
+  size_t i = 0;
+  while (size - i >= 16) {
+    // the 8-bit lanes hold at most 255 matches
+    auto rounds = std::min<size_t>((size - i) / 16, 255);
+    auto acc = _mm_setzero_si128();
+    for (size_t r = 0; r < rounds; r++, i += 16) {
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(load16(data + i), needle));
+    }
+    auto sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+    count += _mm_cvtsi128_si64(sums) +
+             _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+  }
+  return count + count_byte_scalar(data + i, size - i, byte);
+}
+
+// Compare the first and last needle bytes at every position at once and
+// verify the candidates, see http://0x80.pl/articles/simd-strfind.html
+static size_t find_substring_sse2(const char *data, size_t size,
+                                  const char *needle, size_t needle_size) {
+  if (needle_size < 2 || needle_size > size) {
+    return needle_size == 1 ? find_byte_scalar(data, size, needle[0])
+                            : find_substring_scalar(data, size, needle,
+                                                    needle_size);
+  }
+  auto first = _mm_set1_epi8(needle[0]);
+  auto last = _mm_set1_epi8(needle[needle_size - 1]);
+  size_t i = 0;
+  for (; i + needle_size - 1 + 16 <= size; i += 16) {
+    auto eq = _mm_and_si128(
+        _mm_cmpeq_epi8(load16(data + i), first),
+        _mm_cmpeq_epi8(load16(data + i + needle_size - 1), last));
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(eq));
+    for (; mask != 0; mask &= mask - 1) {
+      auto pos = i + std::countr_zero(mask);
+      if (std::memcmp(data + pos + 1, needle + 1, needle_size - 2) == 0) {
+        return pos;
+      }
+    }
+  }
+  auto found = find_substring_scalar(data + i, size - i, needle, needle_size);
+  return found == npos ? npos : i + found;
+}
+
+static size_t find_nth_byte_sse2(const char *data, size_t size, char byte,
+                                 uint64_t &n) {
+  auto needle = _mm_set1_epi8(byte);
+  size_t i = 0;
+  for (; i + 16 <= size && n != 0; i += 16) {
+    auto mask = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(load16(data + i), needle)));
+    auto count = static_cast<uint64_t>(std::popcount(mask));
+    if (count >= n) {
+      auto pos = i + nth_bit(mask, n);
+      n = 0;
+      return pos;
+    }
+    n -= count;
+  }
+  auto found = find_nth_byte_scalar(data + i, size - i, byte, n);
+  return found == npos ? npos : i + found;
+}
+
+static constexpr ByteKernels kSse2Kernels{
+    .name = "sse2",
+    .count_byte = count_byte_sse2,
+    .find_byte = find_byte_scalar,
+    .find_substring = find_substring_sse2,
+    .find_nth_byte = find_nth_byte_sse2,
+};
+
+#define ONED_AVX2 __attribute__((target("avx2,popcnt,bmi")))
+
+ONED_AVX2 static inline __m256i load32(const char *p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));  // NOLINT
+}
+
+ONED_AVX2 static inline uint64_t sum_bytes(__m256i acc) {
+  auto sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+  return _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+         _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+}
+
+ONED_AVX2 static uint64_t count_byte_avx2(const char *data, size_t size,
+                                          char byte) {
+  auto needle = _mm256_set1_epi8(byte);
+  uint64_t count = 0;
+  size_t i = 0;
+  // four independent accumulators keep the loads in flight
+  while (size - i >= 128) {
+    auto rounds = std::min<size_t>((size - i) / 128, 255);
+    auto acc0 = _mm256_setzero_si256();
+    auto acc1 = _mm256_setzero_si256();
+    auto acc2 = _mm256_setzero_si256();
+    auto acc3 = _mm256_setzero_si256();
+    for (size_t r = 0; r < rounds; r++, i += 128) {
+      acc0 = _mm256_sub_epi8(acc0,
+                             _mm256_cmpeq_epi8(load32(data + i), needle));
+      acc1 = _mm256_sub_epi8(
+          acc1, _mm256_cmpeq_epi8(load32(data + i + 32), needle));
+      acc2 = _mm256_sub_epi8(
+          acc2, _mm256_cmpeq_epi8(load32(data + i + 64), needle));
+      acc3 = _mm256_sub_epi8(
+          acc3, _mm256_cmpeq_epi8(load32(data + i + 96), needle));
+    }
+    count += sum_bytes(acc0) + sum_bytes(acc1) + sum_bytes(acc2) +
+             sum_bytes(acc3);
+  }
+  auto acc = _mm256_setzero_si256();
+  for (; i + 32 <= size; i += 32) {
+    acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(load32(data + i), needle));
+  }
+  count += sum_bytes(acc);
+  return count + count_byte_scalar(data + i, size - i, byte);
+}
+
+ONED_AVX2 static size_t find_substring_avx2(const char *data, size_t size,
+                                            const char *needle,
+                                            size_t needle_size) {
+  if (needle_size < 2 || needle_size > size) {
+    return needle_size == 1 ? find_byte_scalar(data, size, needle[0])
+                            : find_substring_scalar(data, size, needle,
+                                                    needle_size);
+  }
+  auto first = _mm256_set1_epi8(needle[0]);
+  auto last = _mm256_set1_epi8(needle[needle_size - 1]);
+  size_t i = 0;
+  for (; i + needle_size - 1 + 32 <= size; i += 32) {
+    auto eq = _mm256_and_si256(
+        _mm256_cmpeq_epi8(load32(data + i), first),
+        _mm256_cmpeq_epi8(load32(data + i + needle_size - 1), last));
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+    for (; mask != 0; mask &= mask - 1) {
+      auto pos = i + std::countr_zero(mask);
+      if (std::memcmp(data + pos + 1, needle + 1, needle_size - 2) == 0) {
+        return pos;
+      }
+    }
+  }
+  auto found = find_substring_sse2(data + i, size - i, needle, needle_size);
+  return found == npos ? npos : i + found;
+}
+
+ONED_AVX2 static size_t find_nth_byte_avx2(const char *data, size_t size,
+                                           char byte, uint64_t &n) {
+  auto needle = _mm256_set1_epi8(byte);
+  size_t i = 0;
+  for (; i + 64 <= size && n != 0; i += 64) {
+    auto mask =
+        static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(load32(data + i), needle))) |
+        static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(load32(data + i + 32), needle))))
+            << 32;
+    auto count = static_cast<uint64_t>(std::popcount(mask));
+    if (count >= n) {
+      auto pos = i + nth_bit(mask, n);
+      n = 0;
+      return pos;
+    }
+    n -= count;
+  }
+  auto found = find_nth_byte_sse2(data + i, size - i, byte, n);
+  return found == npos ? npos : i + found;
+}
+
+static constexpr ByteKernels kAvx2Kernels{
+    .name = "avx2",
+    .count_byte = count_byte_avx2,
+    .find_byte = find_byte_scalar,
+    .find_substring = find_substring_avx2,
+    .find_nth_byte = find_nth_byte_avx2,
+};
+
+#elif defined(__aarch64__)
+
+// NEON is part of AArch64, so this one needs no runtime check.
+
+static inline uint8x16_t load16(const char *p) {
+  return vld1q_u8(reinterpret_cast<const uint8_t *>(p));  // NOLINT
+}
+
+// One bit per byte at bit 4 * i + 3, narrowing is cheaper than a movemask.
+static inline uint64_t match_mask(uint8x16_t eq) {
+  auto nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) &
+         0x8888888888888888ULL;
+}
+
+static uint64_t count_byte_neon(const char *data, size_t size, char byte) {
+  auto needle = vdupq_n_u8(static_cast<uint8_t>(byte));
+  uint64_t count = 0;
+  size_t i = 0;
+  while (size - i >= 16) {
+    auto rounds = std::min<size_t>((size - i) / 16, 255);
+    auto acc = vdupq_n_u8(0);
+    for (size_t r = 0; r < rounds; r++, i += 16) {
+      acc = vsubq_u8(acc, vceqq_u8(load16(data + i), needle));
+    }
+    count += vaddlvq_u8(acc);
+  }
+  return count + count_byte_scalar(data + i, size - i, byte);
+}
+
+static size_t find_substring_neon(const char *data, size_t size,
+                                  const char *needle, size_t needle_size) {
+  if (needle_size < 2 || needle_size > size) {
+    return needle_size == 1 ? find_byte_scalar(data, size, needle[0])
+                            : find_substring_scalar(data, size, needle,
+                                                    needle_size);
+  }
+  auto first = vdupq_n_u8(static_cast<uint8_t>(needle[0]));
+  auto last = vdupq_n_u8(static_cast<uint8_t>(needle[needle_size - 1]));
+  size_t i = 0;
+  for (; i + needle_size - 1 + 16 <= size; i += 16) {
+    auto eq = vandq_u8(vceqq_u8(load16(data + i), first),
+                       vceqq_u8(load16(data + i + needle_size - 1), last));
+    for (auto mask = match_mask(eq); mask != 0; mask &= mask - 1) {
+      auto pos = i + std::countr_zero(mask) / 4;
+      if (std::memcmp(data + pos + 1, needle + 1, needle_size - 2) == 0) {
+        return pos;
+      }
+    }
+  }
+  auto found = find_substring_scalar(data + i, size - i, needle, needle_size);
+  return found == npos ? npos : i + found;
+}
+
+static size_t find_nth_byte_neon(const char *data, size_t size, char byte,
+                                 uint64_t &n) {
+  auto needle = vdupq_n_u8(static_cast<uint8_t>(byte));
+  size_t i = 0;
+  for (; i + 16 <= size && n != 0; i += 16) {
+    auto mask = match_mask(vceqq_u8(load16(data + i), needle));
+    auto count = static_cast<uint64_t>(std::popcount(mask));
+    if (count >= n) {
+      auto pos = i + nth_bit(mask, n) / 4;
+      n = 0;
+      return pos;
+    }
+    n -= count;
+  }
+  auto found = find_nth_byte_scalar(data + i, size - i, byte, n);
+  return found == npos ? npos : i + found;
+}
+
+static constexpr ByteKernels kNeonKernels{
+    .name = "neon",
+    .count_byte = count_byte_neon,
+    .find_byte = find_byte_scalar,
+    .find_substring = find_substring_neon,
+    .find_nth_byte = find_nth_byte_neon,
+};
+
+#endif
+
+const std::vector<const ByteKernels *> &supported_byte_kernels() {
+  static const auto kernels = [] {
+    std::vector<const ByteKernels *> ret;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") &&
+        __builtin_cpu_supports("bmi")) {
+      ret.push_back(&kAvx2Kernels);
+    }
+    ret.push_back(&kSse2Kernels);
+#elif defined(__aarch64__)
+    ret.push_back(&kNeonKernels);
+#endif
+    ret.push_back(&kScalarKernels);
+    return ret;
+  }();
+  return kernels;
+}
+
+}  // namespace oned
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace oned {
+
+// One implementation of the byte scanning kernels. All positions are
+// relative to `data`, npos when nothing matches.
+struct ByteKernels {
+  const char *name;
+  uint64_t (*count_byte)(const char *data, size_t size, char byte);
+  size_t (*find_byte)(const char *data, size_t size, char byte);
+  size_t (*find_substring)(const char *data, size_t size, const char *needle,
+                           size_t needle_size);
+  // Position of the n-th (from 1) `byte`. When there are fewer, returns npos
+  // and subtracts the ones seen from `n`, so a scan can carry on into the
+  // next chunk.
+  size_t (*find_nth_byte)(const char *data, size_t size, char byte,
+                          uint64_t &n);
+};
+
+// Every implementation the running CPU supports, the fastest first.
+const std::vector<const ByteKernels *> &supported_byte_kernels();
+
+inline const ByteKernels &byte_kernels() {
+  static const ByteKernels *best = supported_byte_kernels().front();
+  return *best;
+}
+
+inline uint64_t count_byte(std::string_view data, char byte) {
+  return byte_kernels().count_byte(data.data(), data.size(), byte);
+}
+
+inline size_t find_byte(std::string_view data, char byte) {
+  return byte_kernels().find_byte(data.data(), data.size(), byte);
+}
+
+inline size_t find_substring(std::string_view data, std::string_view needle) {
+  return byte_kernels().find_substring(data.data(), data.size(),
+                                       needle.data(), needle.size());
+}
+
+inline size_t find_nth_newline(std::string_view data, uint64_t &n) {
+  return byte_kernels().find_nth_byte(data.data(), data.size(), '\n', n);
+}
+
+}  // namespace oned
@@ -0,0 +1,65 @@
+#include "byte_scan.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <limits>
+#include <random>
+
+using namespace oned;
+
+// 256 KiB stays in L2, so this measures the kernels rather than memory
+static std::string log_like_data() {
+  std::mt19937 rng(42);
+  std::string data;
+  while (data.size() < 256 * 1024) {
+    data.append(40 + rng() % 80, 'x');
+    data += '\n';
+  }
+  return data;
+}
+
+using Op = uint64_t (*)(const ByteKernels &, std::string_view);
+
+static void run(benchmark::State &state, const ByteKernels &k, Op op) {
+  auto data = log_like_data();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(op(k, data));
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * data.size());
+}
+
+static uint64_t count_newlines(const ByteKernels &k, std::string_view data) {
+  return k.count_byte(data.data(), data.size(), '\n');
+}
+
+static uint64_t find_missing_byte(const ByteKernels &k,
+                                  std::string_view data) {
+  return k.find_byte(data.data(), data.size(), '\0');
+}
+
+static uint64_t find_missing_substring(const ByteKernels &k,
+                                       std::string_view data) {
+  return k.find_substring(data.data(), data.size(), "x\nxy", 4);
+}
+
+static uint64_t find_last_newline(const ByteKernels &k,
+                                  std::string_view data) {
+  uint64_t n = std::numeric_limits<uint64_t>::max();
+  return k.find_nth_byte(data.data(), data.size(), '\n', n);
+}
+
+static const bool registered = [] {
+  for (const auto *k : supported_byte_kernels()) {
+    for (auto [name, op] : {std::pair<const char *, Op>{"count_byte",
+                                                        count_newlines},
+                            {"find_byte", find_missing_byte},
+                            {"find_substring", find_missing_substring},
+                            {"find_nth_byte", find_last_newline}}) {
+      benchmark::RegisterBenchmark(
+          fmt::format("BM_{}/{}", name, k->name).c_str(),
+          [k, op](benchmark::State &state) { run(state, *k, op); });
+    }
+  }
+  return true;
+}();
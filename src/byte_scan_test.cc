@@ -0,0 +1,101 @@
+#include "byte_scan.hh"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+using namespace oned;
+
+static constexpr size_t npos = std::string_view::npos;
+
+// Every supported kernel against plain loops, over all alignments and
+// lengths around the vector widths.
+class ByteScanTest : public ::testing::TestWithParam<const ByteKernels *> {
+protected:
+  void SetUp() override {
+    std::mt19937 rng(42);
+    // few distinct bytes so matches and near misses are frequent
+    data_.resize(4096);
+    for (auto &c : data_) {
+      c = "ab\n"[rng() % 3];
+    }
+  }
+
+  std::string data_;
+};
+
+TEST_P(ByteScanTest, CountAndFind) {
+  const auto &k = *GetParam();
+  for (size_t start = 0; start < 64; start++) {
+    for (size_t size = 0; start + size <= data_.size();
+         size += size < 300 ? 1 : 97) {
+      std::string_view view(data_.data() + start, size);
+      for (char byte : {'\n', 'a', 'z'}) {
+        ASSERT_EQ(k.count_byte(view.data(), view.size(), byte),
+                  static_cast<uint64_t>(std::count(view.begin(), view.end(),
+                                                   byte)))
+            << start << " " << size;
+        ASSERT_EQ(k.find_byte(view.data(), view.size(), byte),
+                  view.find(byte))
+            << start << " " << size;
+      }
+    }
+  }
+}
+
+TEST_P(ByteScanTest, FindNth) {
+  const auto &k = *GetParam();
+  for (size_t start = 0; start < 64; start++) {
+    std::string_view view(data_.data() + start, 1000 + start);
+    std::vector<size_t> newlines;
+    for (size_t i = 0; i < view.size(); i++) {
+      if (view[i] == '\n') {
+        newlines.push_back(i);
+      }
+    }
+    for (uint64_t nth = 1; nth <= newlines.size(); nth++) {
+      auto n = nth;
+      ASSERT_EQ(k.find_nth_byte(view.data(), view.size(), '\n', n),
+                newlines[nth - 1]);
+      ASSERT_EQ(n, 0);
+    }
+    auto n = newlines.size() + 5;
+    ASSERT_EQ(k.find_nth_byte(view.data(), view.size(), '\n', n), npos);
+    ASSERT_EQ(n, 5);
+  }
+}
+
+TEST_P(ByteScanTest, FindSubstring) {
+  const auto &k = *GetParam();
+  std::mt19937 rng(7);
+  for (size_t needle_size : {0, 1, 2, 3, 5, 8, 17, 40}) {
+    for (int i = 0; i < 200; i++) {
+      auto start = rng() % 64;
+      auto size = rng() % 600;
+      std::string_view view(data_.data() + start, size);
+      // needles cut from the data hit, shuffled ones mostly miss
+      std::string needle = data_.substr(rng() % 3000, needle_size);
+      if (i % 2 == 1) {
+        std::shuffle(needle.begin(), needle.end(), rng);
+      }
+      ASSERT_EQ(k.find_substring(view.data(), view.size(), needle.data(),
+                                 needle.size()),
+                view.find(needle))
+          << start << " " << size << " " << needle;
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Kernels, ByteScanTest, ::testing::ValuesIn(supported_byte_kernels()),
+    [](const auto &info) { return std::string(info.param->name); });
+
+TEST(ByteScan, Dispatch) {
+  EXPECT_EQ(&byte_kernels(), supported_byte_kernels().front());
+  EXPECT_STREQ(supported_byte_kernels().back()->name, "scalar");
+  EXPECT_EQ(count_byte("a\nb\n", '\n'), 2);
+  EXPECT_EQ(find_byte("abc", 'c'), 2);
+  EXPECT_EQ(find_substring("hello world", "world"), 6);
+  uint64_t n = 2;
+  EXPECT_EQ(find_nth_newline("a\nb\nc", n), 3);
+}
@@ -1,8 +1,17 @@
 #include "chunk.hh"
+#include "compressed_chunk_loader.hh"
+#include "direct_chunk_loader.hh"
+#include "io_uring_chunk_loader.hh"
 #include "noncopyable.hh"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cassert>
 #include <cerrno>
+#include <mutex>
 
 namespace oned {
 
@@ -45,14 +54,21 @@ std::vector<ChunkView> calculate_chunk_views(uint64_t offset, uint64_t length,
   return ret;
 }
 
+static Result<uint64_t> fd_size(int fd) {
+  struct stat st {};
+  if (fstat(fd, &st) == -1) {
+    return errno_to_errc(errno);
+  }
+  return static_cast<uint64_t>(st.st_size);
+}
+
 class FileChunkLoader final : public ChunkLoader, NonCopyable {
 public:
   FileChunkLoader(std::FILE* file, uint64_t file_size)
       : file_(file), file_size_(file_size) {}
 
-  FileChunkLoader(FileChunkLoader&&) noexcept = default;
-
-  FileChunkLoader& operator=(FileChunkLoader&&) noexcept = default;
+  FileChunkLoader(FileChunkLoader&&) = delete;
+  FileChunkLoader& operator=(FileChunkLoader&&) = delete;
 
   ~FileChunkLoader() final {
     if (file_ != nullptr) {
@@ -61,36 +77,209 @@ public:
   }
 
   uint64_t size() const final {
-    return file_size_;
+    return file_size_.load(std::memory_order_acquire);
   }
 
-  Result<std::string> read_chunk(uint64_t offset, uint32_t length) final {
-    if (auto ret = fseek(file_, static_cast<long>(offset), SEEK_SET);
-        ret == -1L) {
-      return errno_to_errc(errno);
+  Result<uint64_t> refresh_size() final {
+    auto size = TRYX(fd_size(fileno(file_)));
+    // a shrinking file was truncated or replaced, keep serving the old view
+    if (size > file_size_.load(std::memory_order_relaxed)) {
+      file_size_.store(size, std::memory_order_release);
     }
+    return file_size_.load(std::memory_order_relaxed);
+  }
 
+  Result<std::string> read_chunk(uint64_t offset, uint32_t length) final {
     std::string data;
     data.resize(length);
-    auto n = fread(data.data(), sizeof(char), length, file_);
-    if (n != length) {
-      if (feof(file_) != 0) {
+    TRYV(read_chunk_into(offset, data));
+    return data;
+  }
+
+  Result<void> read_chunk_into(uint64_t offset, std::span<char> out) final {
+    // pread keeps no shared file position, so concurrent reads are fine
+    size_t done = 0;
+    while (done < out.size()) {
+      auto n = pread(fileno(file_), out.data() + done, out.size() - done,
+                     static_cast<off_t>(offset + done));
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return errno_to_errc(errno);
+      }
+      if (n == 0) {
         return make_error(GenericErrc::io_error,
-                          fmt::format("unexpected EOF when reading at {}~{}",
-                                      offset, length));
+                          lazy_format("unexpected EOF when reading at {}~{}",
+                                      offset, out.size()));
       }
-      return GenericErrc::io_error;
+      done += n;
     }
-
-    return data;
+    return outcome::success();
   }
 
 private:
   std::FILE* file_;
-  uint64_t file_size_;
+  std::atomic<uint64_t> file_size_;
 };
 
-Result<ChunkLoaderPtr> ChunkLoader::open(const char* path) {
+class MmapChunkLoader final : public ChunkLoader, NonCopyable {
+public:
+  MmapChunkLoader(int fd, void* addr, uint64_t file_size)
+      : fd_(fd), addr_(addr), mapped_size_(file_size), file_size_(file_size) {}
+
+  MmapChunkLoader(MmapChunkLoader&&) = delete;
+  MmapChunkLoader& operator=(MmapChunkLoader&&) = delete;
+
+  ~MmapChunkLoader() final {
+    munmap(addr_.load(std::memory_order_relaxed), mapped_size_);
+    for (auto [addr, size] : retired_) {
+      munmap(addr, size);
+    }
+    close(fd_);
+  }
+
+  uint64_t size() const final {
+    return file_size_.load(std::memory_order_acquire);
+  }
+
+  Result<std::string> read_chunk(uint64_t offset, uint32_t length) final {
+    return std::string(TRYX(map_chunk(offset, length)));
+  }
+
+  bool mapped() const final {
+    return true;
+  }
+
+  Result<std::string_view> map_chunk(uint64_t offset, uint32_t length) final {
+    if (truncated_.load(std::memory_order_acquire)) {
+      return make_error(GenericErrc::io_error, "file truncated while mapped");
+    }
+    // the size is published after the mapping covering it
+    auto file_size = size();
+    if (offset > file_size || file_size - offset < length) {
+      return make_error(GenericErrc::invalid_argument,
+                        lazy_format("read at {}~{} beyond EOF {}", offset,
+                                    length, file_size));
+    }
+    auto* addr = static_cast<const char*>(addr_.load(std::memory_order_acquire));
+    return std::string_view(addr + offset, length);
+  }
+
+  void advise(AccessHint hint) final {
+    auto advice = MADV_NORMAL;
+    if (hint == AccessHint::sequential) {
+      advice = MADV_SEQUENTIAL;
+    } else if (hint == AccessHint::random) {
+      advice = MADV_RANDOM;
+    }
+    hint_ = hint;
+    // only a hint, the mapping works regardless of the outcome
+    madvise(addr_.load(std::memory_order_relaxed), size(), advice);
+  }
+
+  // Pages past EOF fill in as the file grows, so the mapping only has to be
+  // replaced once the file outgrows it. Views into the old mapping may still
+  // be in use, it stays mapped until the loader goes away. The new mapping
+  // is twice as large to keep the number of retired ones small.
+  //
+  // Touching pages past EOF raises SIGBUS, so a shrunk file fails every
+  // later map_chunk. Until the shrink is noticed here reads still fault.
+  Result<uint64_t> refresh_size() final {
+    std::lock_guard lock(refresh_mutex_);
+    auto size = TRYX(fd_size(fd_));
+    auto old_size = file_size_.load(std::memory_order_relaxed);
+    if (size < old_size || truncated_.load(std::memory_order_relaxed)) {
+      truncated_.store(true, std::memory_order_release);
+      return make_error(GenericErrc::io_error,
+                        lazy_format("file shrank from {} to {} bytes",
+                                    old_size, size));
+    }
+    if (size == old_size) {
+      return old_size;
+    }
+    if (size > mapped_size_) {
+      auto mapped_size = std::max(size, mapped_size_ * 2);
+      auto* addr = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd_, 0);
+      if (addr == MAP_FAILED) {  // NOLINT
+        return errno_to_errc(errno);
+      }
+      retired_.emplace_back(addr_.load(std::memory_order_relaxed),
+                            mapped_size_);
+      addr_.store(addr, std::memory_order_release);
+      mapped_size_ = mapped_size;
+      file_size_.store(size, std::memory_order_release);
+      advise(hint_);
+      return size;
+    }
+    file_size_.store(size, std::memory_order_release);
+    return size;
+  }
+
+private:
+  int fd_;
+  std::atomic<void*> addr_;
+  // touched by refresh_size only
+  std::mutex refresh_mutex_;
+  uint64_t mapped_size_;
+  std::vector<std::pair<void*, uint64_t>> retired_;
+  AccessHint hint_ = AccessHint::normal;
+  std::atomic<uint64_t> file_size_;
+  std::atomic<bool> truncated_{false};
+};
+
+static Result<ChunkLoaderPtr> open_mmap_loader(const char* path,
+                                               AccessHint hint) {
+  auto fd = ::open(path, O_RDONLY | O_CLOEXEC);  // NOLINT
+  if (fd == -1) {
+    return errno_to_errc(errno);
+  }
+
+  struct stat st {};
+  if (fstat(fd, &st) == -1) {
+    auto e = errno;
+    close(fd);
+    return errno_to_errc(e);
+  }
+  // pipes and empty files can't be mapped
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return GenericErrc::not_supported;
+  }
+
+  auto file_size = static_cast<uint64_t>(st.st_size);
+  auto addr = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {  // NOLINT
+    auto e = errno;
+    close(fd);
+    return errno_to_errc(e);
+  }
+
+  // the fd stays open to follow the file as it grows
+  auto loader = std::make_unique<MmapChunkLoader>(fd, addr, file_size);
+  loader->advise(hint);
+  return loader;
+}
+
+Result<ChunkLoaderPtr> ChunkLoader::open(const char* path,
+                                         ChunkLoaderOptions options) {
+  if (options.kind == ChunkLoaderKind::io_uring) {
+    return open_io_uring_loader(path);
+  }
+  if (options.kind == ChunkLoaderKind::direct) {
+    return open_direct_loader(path);
+  }
+  if (options.kind == ChunkLoaderKind::compressed ||
+      (options.kind == ChunkLoaderKind::automatic &&
+       is_compressed_file(path))) {
+    return open_compressed_loader(path);
+  }
+  // opt-in, a file truncated under the mapping faults instead of failing
+  // the read
+  if (options.kind == ChunkLoaderKind::mmap) {
+    return open_mmap_loader(path, options.access);
+  }
+
   auto file = fopen(path, "rb");  // NOLINT
   if (file == nullptr) {
     return errno_to_errc(errno);
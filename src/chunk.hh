@@ -1,11 +1,17 @@
 #pragma once
 
+#include "chunk_buffer.hh"
 #include "outcome.hh"
 
 #include <boost/intrusive/list.hpp>
 
+#include <atomic>
+#include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace oned {
@@ -31,11 +37,45 @@ struct Chunk : public boost::intrusive::list_base_hook<> {
   }
 
   void reset() {
-    std::string s;
-    std::swap(data, s);
+    data.reset();
   }
 
-  std::string data;
+  ChunkBuffer data;
+  // outstanding ChunkHandles, pinned chunks are never evicted
+  uint32_t pins_ = 0;
+  // loaded by read-ahead and not touched by a reader yet
+  bool prefetched_ = false;
+  // which of its lists the eviction policy keeps the chunk on
+  uint8_t queue_ = 0;
+  ChunkID id_ = 0;
+};
+
+struct ChunkRange {
+  uint64_t offset_;
+  uint32_t length_;
+};
+
+enum class ChunkLoaderKind : uint8_t {
+  // decompress .gz/.zst, stdio for the rest
+  automatic,
+  stdio,
+  // zero-copy views, but reads of a file truncated before the next
+  // refresh_size raise SIGBUS
+  mmap,
+  io_uring,  // batched reads, preadv when io_uring is unavailable
+  compressed,
+  direct,  // O_DIRECT, bypasses the page cache
+};
+
+enum class AccessHint : uint8_t {
+  normal,
+  sequential,
+  random,
+};
+
+struct ChunkLoaderOptions {
+  ChunkLoaderKind kind = ChunkLoaderKind::automatic;
+  AccessHint access = AccessHint::normal;
 };
 
 struct ChunkLoader {  // NOLINT
@@ -43,9 +83,67 @@ struct ChunkLoader {  // NOLINT
 
   virtual ~ChunkLoader() = default;
   virtual uint64_t size() const = 0;
+  // May be called from several threads at once.
   virtual Result<std::string> read_chunk(uint64_t offset, uint32_t length) = 0;
 
-  static Result<Ptr> open(const char* path);
+  // Read a batch of ranges, loaders that can overlap the I/O override this.
+  virtual Result<std::vector<std::string>> read_chunks(
+      const std::vector<ChunkRange>& ranges) {
+    std::vector<std::string> ret;
+    ret.reserve(ranges.size());
+    for (auto& r : ranges) {
+      ret.push_back(TRYX(read_chunk(r.offset_, r.length_)));
+    }
+    return ret;
+  }
+
+  // Fill `out` with the bytes at `offset`, e.g. a pooled ChunkBuffer.
+  // Loaders that can read in place override this to skip the copy.
+  virtual Result<void> read_chunk_into(uint64_t offset, std::span<char> out) {
+    auto data = TRYX(read_chunk(offset, static_cast<uint32_t>(out.size())));
+    assert(data.size() == out.size());
+    std::memcpy(out.data(), data.data(), data.size());
+    return outcome::success();
+  }
+
+  // read_chunks into caller buffers, `outs[i]` receives `ranges[i]`. Fails
+  // with GenericErrc::state_not_recoverable when reads may still be writing
+  // into `outs`, the caller must then never free or reuse them.
+  virtual Result<void> read_chunks_into(
+      const std::vector<ChunkRange>& ranges,
+      const std::vector<std::span<char>>& outs) {
+    assert(ranges.size() == outs.size());
+    for (std::size_t i = 0; i < ranges.size(); i++) {
+      TRYV(read_chunk_into(ranges[i].offset_, outs[i]));
+    }
+    return outcome::success();
+  }
+
+  // Alignment read_chunk_into needs of `out` to read in place, the
+  // ChunkManager allocates its chunk buffers with it.
+  virtual size_t alignment() const {
+    return 1;
+  }
+
+  // Loaders that keep the whole file mapped serve views straight from the
+  // mapping; the views stay valid for the lifetime of the loader.
+  virtual bool mapped() const {
+    return false;
+  }
+  virtual Result<std::string_view> map_chunk(uint64_t /*offset*/,
+                                             uint32_t /*length*/) {
+    return GenericErrc::operation_not_supported;
+  }
+
+  virtual void advise(AccessHint /*hint*/) {}
+
+  // Pick up data appended since open and return the new size, size() follows
+  // once this returns. Loaders whose content can't grow keep their size.
+  virtual Result<uint64_t> refresh_size() {
+    return size();
+  }
+
+  static Result<Ptr> open(const char* path, ChunkLoaderOptions options = {});
 };
 using ChunkLoaderPtr = std::unique_ptr<ChunkLoader>;
 
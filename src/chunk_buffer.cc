@@ -0,0 +1,115 @@
+#include "chunk_buffer.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace oned {
+
+ChunkBuffer::ChunkBuffer(ChunkBuffer &&other) noexcept
+    : pool_(std::exchange(other.pool_, nullptr)),
+      block_(std::exchange(other.block_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      capacity_(std::exchange(other.capacity_, 0)) {}
+
+ChunkBuffer &ChunkBuffer::operator=(ChunkBuffer &&other) noexcept {
+  if (this != &other) {
+    reset();
+    pool_ = std::exchange(other.pool_, nullptr);
+    block_ = std::exchange(other.block_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    capacity_ = std::exchange(other.capacity_, 0);
+  }
+  return *this;
+}
+
+ChunkBuffer::~ChunkBuffer() {
+  reset();
+}
+
+void ChunkBuffer::append(std::string_view data) {
+  assert(size_ + data.size() <= capacity_);
+  std::memcpy(block_ + size_, data.data(), data.size());
+  size_ += static_cast<uint32_t>(data.size());
+}
+
+void ChunkBuffer::reset() {
+  if (block_ != nullptr) {
+    pool_->release(block_);
+  }
+  pool_ = nullptr;
+  block_ = nullptr;
+  size_ = 0;
+  capacity_ = 0;
+}
+
+ChunkBufferPool::ChunkBufferPool(uint32_t buffer_size, size_t max_free,
+                                 size_t alignment)
+    : buffer_size_(buffer_size),
+      alignment_(std::max<size_t>(alignment, 1)),
+      block_size_(block_size(buffer_size, alignment_)),
+      max_free_(max_free) {}
+
+size_t ChunkBufferPool::block_size(uint32_t buffer_size, size_t alignment) {
+  alignment = std::max<size_t>(alignment, 1);
+  return (std::max<size_t>(buffer_size, 1) + alignment - 1) / alignment *
+         alignment;
+}
+
+ChunkBufferPool::~ChunkBufferPool() {
+  for (auto *block : free_) {
+    std::free(block);  // NOLINT
+  }
+}
+
+ChunkBuffer ChunkBufferPool::acquire() {
+  {
+    std::lock_guard lock(mutex_);
+    if (!free_.empty()) {
+      auto *block = free_.back();
+      free_.pop_back();
+      return ChunkBuffer(this, block, buffer_size_);
+    }
+    allocations_++;
+  }
+  // malloc already aligns for any type, and doesn't round the block up
+  auto *block = static_cast<char *>(
+      alignment_ <= alignof(std::max_align_t)
+          ? std::malloc(block_size_)                        // NOLINT
+          : std::aligned_alloc(alignment_, block_size_));  // NOLINT
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ChunkBuffer(this, block, buffer_size_);
+}
+
+void ChunkBufferPool::release(char *block) {
+  {
+    std::lock_guard lock(mutex_);
+    if (free_.size() < max_free_) {
+      free_.push_back(block);
+      return;
+    }
+  }
+  std::free(block);  // NOLINT
+}
+
+uint64_t ChunkBufferPool::free_bytes() const {
+  std::lock_guard lock(mutex_);
+  return free_.size() * block_size_;
+}
+
+size_t ChunkBufferPool::free_blocks() const {
+  std::lock_guard lock(mutex_);
+  return free_.size();
+}
+
+uint64_t ChunkBufferPool::allocations() const {
+  std::lock_guard lock(mutex_);
+  return allocations_;
+}
+
+}  // namespace oned
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "noncopyable.hh"
+
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace oned {
+
+class ChunkBufferPool;
+
+// Chunk data in a fixed-size block from a ChunkBufferPool. The block goes
+// back to the pool when the buffer is reset or destroyed, the pool must
+// outlive its buffers.
+class ChunkBuffer : NonCopyable {
+public:
+  ChunkBuffer() = default;
+  ChunkBuffer(ChunkBuffer &&other) noexcept;
+  ChunkBuffer &operator=(ChunkBuffer &&other) noexcept;
+  ~ChunkBuffer();
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  uint32_t size() const {
+    return size_;
+  }
+
+  // the pool's buffer_size, the block itself may be rounded up
+  uint32_t capacity() const {
+    return capacity_;
+  }
+
+  std::string_view view() const {
+    return {block_, size_};
+  }
+
+  // Set the size and return the bytes for the caller to fill.
+  std::span<char> resize(uint32_t size) {
+    assert(size <= capacity_);
+    size_ = size;
+    return {block_, size_};
+  }
+
+  // Views handed out so far stay valid, the block never moves.
+  void append(std::string_view data);
+
+  void reset();
+
+  // Give up the block without returning it to the pool, for memory a failed
+  // read may still write into.
+  void leak() {
+    pool_ = nullptr;
+    block_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+  }
+
+private:
+  friend class ChunkBufferPool;
+
+  ChunkBuffer(ChunkBufferPool *pool, char *block, uint32_t capacity)
+      : pool_(pool), block_(block), capacity_(capacity) {}
+
+  ChunkBufferPool *pool_ = nullptr;
+  char *block_ = nullptr;
+  uint32_t size_ = 0;
+  uint32_t capacity_ = 0;
+};
+
+// Recycles the blocks of evicted chunks, so a miss in steady state costs no
+// trip through malloc. Thread-safe.
+class ChunkBufferPool : NonCopyable {
+public:
+  // The default alignment, which satisfies O_DIRECT.
+  static constexpr size_t kAlignment = 4096;
+
+  // Up to `max_free` returned blocks are kept for reuse, the rest is freed.
+  // Blocks are aligned to and rounded up to `alignment`.
+  ChunkBufferPool(uint32_t buffer_size, size_t max_free,
+                  size_t alignment = kAlignment);
+
+  ChunkBufferPool(ChunkBufferPool &&) = delete;
+  ChunkBufferPool &operator=(ChunkBufferPool &&) = delete;
+  ~ChunkBufferPool();
+
+  ChunkBuffer acquire();
+
+  uint32_t buffer_size() const {
+    return buffer_size_;
+  }
+
+  // bytes a block takes, buffer_size rounded up to the alignment
+  size_t block_size() const {
+    return block_size_;
+  }
+
+  static size_t block_size(uint32_t buffer_size, size_t alignment);
+
+  // bytes of blocks waiting for reuse
+  uint64_t free_bytes() const;
+
+  // blocks waiting for reuse
+  size_t free_blocks() const;
+
+  // blocks ever allocated, stays flat once the cache is warm
+  uint64_t allocations() const;
+
+private:
+  friend class ChunkBuffer;
+
+  void release(char *block);
+
+  uint32_t buffer_size_;
+  size_t alignment_;
+  size_t block_size_;
+  size_t max_free_;
+
+  mutable std::mutex mutex_;
+  std::vector<char *> free_;
+  uint64_t allocations_ = 0;
+};
+
+}  // namespace oned
@@ -0,0 +1,47 @@
+#include "chunk_buffer.hh"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace oned;
+
+TEST(ChunkBufferPool, aligned_and_recycled) {
+  ChunkBufferPool pool(10000, 2);
+  auto a = pool.acquire();
+  ASSERT_EQ(a.capacity(), 10000);
+  ASSERT_TRUE(a.empty());
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(a.view().data()) %  // NOLINT
+                ChunkBufferPool::kAlignment,
+            0);
+
+  auto* block = a.resize(100).data();
+  a.reset();
+  ASSERT_EQ(pool.free_bytes(), 12288);
+  auto b = pool.acquire();
+  ASSERT_EQ(b.resize(1).data(), block);
+  ASSERT_EQ(pool.allocations(), 1);
+
+  // only max_free blocks are kept
+  std::vector<ChunkBuffer> held;
+  for (int i = 0; i < 4; i++) {
+    held.push_back(pool.acquire());
+  }
+  held.clear();
+  ASSERT_EQ(pool.free_bytes(), 2 * 12288);
+}
+
+TEST(ChunkBuffer, append_in_place) {
+  ChunkBufferPool pool(16, 1);
+  auto buf = pool.acquire();
+  auto out = buf.resize(5);
+  std::memcpy(out.data(), "hello", 5);
+  auto view = buf.view();
+  buf.append(" world");
+  ASSERT_EQ(buf.view(), "hello world");
+  ASSERT_EQ(view.data(), buf.view().data());
+
+  auto moved = std::move(buf);
+  ASSERT_TRUE(buf.empty());  // NOLINT
+  ASSERT_EQ(moved.view(), "hello world");
+}
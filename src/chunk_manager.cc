@@ -2,57 +2,516 @@
 
 namespace oned {
 
+// Buffers the pool keeps for reuse, their share of the limit is taken off
+// the shards'.
+static uint64_t pool_buffers(uint64_t chunk_memory_limit, uint64_t block_size) {
+  return chunk_memory_limit / block_size / 8;
+}
+
 ChunkManager::ChunkManager(ChunkLoaderPtr loader, uint32_t chunk_size,
-                           uint64_t chunk_memory_limit)
+                           uint64_t chunk_memory_limit,
+                           ChunkManagerOptions options)
     : loader_(std::move(loader)),
-      chunks_(loader_->size() / chunk_size + 1),
+      size_(loader_->size()),
+      // every chunk has a full buffer, so the last one grows in place when
+      // the file does; an eighth of the limit may wait in the pool
+      pool_(chunk_size,
+            pool_buffers(chunk_memory_limit,
+                         ChunkBufferPool::block_size(chunk_size,
+                                                     loader_->alignment())),
+            loader_->alignment()),
+      shards_(std::max(options.shard_count, 1U)),
       chunk_size_(chunk_size),
-      chunk_memory_limit_(chunk_memory_limit) {}
+      chunk_memory_limit_(chunk_memory_limit),
+      shard_memory_limit_(
+          (chunk_memory_limit -
+           pool_buffers(chunk_memory_limit, pool_.block_size()) *
+               pool_.block_size()) /
+          shards_.size()),
+      // leave at least half of the cache to the chunks being read
+      readahead_(loader_->mapped()
+                     ? 0
+                     : static_cast<uint32_t>(std::min<uint64_t>(
+                           options.max_readahead,
+                           chunk_memory_limit / pool_.block_size() / 2))) {
+  auto capacity =
+      std::max<uint64_t>(shard_memory_limit_ / pool_.block_size(), 1);
+  for (auto &shard : shards_) {
+    shard.policy_ = EvictionPolicy::make(options.eviction, capacity);
+  }
+  if (readahead_.max_window() != 0) {
+    prefetch_thread_ = std::thread([this] { prefetch_loop(); });
+  }
+}
+
+ChunkManager::~ChunkManager() {
+  {
+    std::lock_guard lock(prefetch_mutex_);
+    stop_ = true;
+  }
+  prefetch_cv_.notify_one();
+  if (prefetch_thread_.joinable()) {
+    prefetch_thread_.join();
+  }
+}
+
+ChunkHandle::ChunkHandle(ChunkHandle &&other) noexcept
+    : mgr_(std::exchange(other.mgr_, nullptr)),
+      id_(other.id_),
+      view_(std::exchange(other.view_, {})) {}
+
+ChunkHandle &ChunkHandle::operator=(ChunkHandle &&other) noexcept {
+  if (this != &other) {
+    release();
+    mgr_ = std::exchange(other.mgr_, nullptr);
+    id_ = other.id_;
+    view_ = std::exchange(other.view_, {});
+  }
+  return *this;
+}
 
-Result<std::string_view> ChunkManager::get_chunk(ChunkView view) {
+ChunkHandle::~ChunkHandle() {
+  release();
+}
+
+void ChunkHandle::release() {
+  if (mgr_ != nullptr) {
+    mgr_->unpin(id_);
+    mgr_ = nullptr;
+  }
+  view_ = {};
+}
+
+Result<ChunkHandle> ChunkManager::get_chunk(ChunkView view) {
   auto &[id, off, len] = view;
-  assert(id < chunks_.size());
-  assert(id * chunk_size_ + off + len <= loader_->size());
-  TRYV(touch_chunk(id));
-  return std::string_view(chunks_[id].data).substr(off, len);
+  assert(uint64_t(id) * chunk_size_ + off + len <= size());
+  // mapped loaders leave caching and eviction to the kernel page cache
+  if (loader_->mapped()) {
+    auto str = TRYX(loader_->map_chunk(uint64_t(id) * chunk_size_ + off, len));
+    return ChunkHandle(nullptr, id, str);
+  }
+  std::string_view str;
+  TRYV(touch_chunk(id, [&](Chunk &c) {
+    c.pins_++;
+    str = c.data.view().substr(off, len);
+  }));
+  return ChunkHandle(this, id, str);
 }
 
-Result<std::vector<std::string_view>> ChunkManager::get_chunks(
+Result<std::vector<ChunkHandle>> ChunkManager::get_chunks(
     const std::vector<ChunkView> &views) {
-  std::vector<std::string_view> ret;
+  // fetch the misses as one batch, its handles are handed out as they are,
+  // touching those chunks again would count them twice and promote them in
+  // the eviction policy
+  std::vector<ChunkHandle> loaded;
+  if (!loader_->mapped()) {
+    loaded = TRYX(load_chunks(views));
+  }
+
+  std::vector<ChunkHandle> ret;
+  ret.reserve(views.size());
   for (auto &v : views) {
-    auto str = TRYX(get_chunk(v));
-    ret.push_back(str);
+    // sorted by id
+    auto iter = std::lower_bound(
+        loaded.begin(), loaded.end(), v.id_,
+        [](const ChunkHandle &h, ChunkID id) { return h.id_ < id; });
+    if (iter == loaded.end() || iter->id_ != v.id_) {
+      ret.push_back(TRYX(get_chunk(v)));
+      continue;
+    }
+    // a chunk may be asked for twice, the first handle keeps it resident
+    auto handle = iter->mgr_ == nullptr ? pin(v.id_) : std::move(*iter);
+    handle.view_ = handle.view_.substr(v.offset_, v.length_);
+    ret.push_back(std::move(handle));
   }
   return ret;
 }
 
-Result<void> ChunkManager::touch_chunk(ChunkID id) {
-  auto &c = chunks_[id];
+ChunkHandle ChunkManager::pin(ChunkID id) {
+  auto &shard = shard_of(id);
+  std::lock_guard lock(shard.mutex_);
+  auto &c = shard.chunks_.at(id);
+  c.pins_++;
+  return ChunkHandle(this, id, c.data.view());
+}
 
-  // move to front of LRU
-  if (c.is_linked()) {
-    lru_.erase(lru_.iterator_to(c));
+Result<std::string> ChunkManager::read(ChunkView view) {
+  auto &[id, off, len] = view;
+  assert(uint64_t(id) * chunk_size_ + off + len <= size());
+  if (loader_->mapped()) {
+    return std::string(
+        TRYX(loader_->map_chunk(uint64_t(id) * chunk_size_ + off, len)));
   }
-  lru_.push_front(c);
+  std::string ret;
+  TRYV(touch_chunk(id,
+                   [&](Chunk &c) { ret = c.data.view().substr(off, len); }));
+  return ret;
+}
 
-  if (!c.empty()) {
+PrefetchStats ChunkManager::prefetch_stats() const {
+  PrefetchStats stats{
+      .issued = prefetch_issued_.load(std::memory_order_relaxed),
+      .hits = prefetch_hits_.load(std::memory_order_relaxed),
+      .misses = prefetch_misses_.load(std::memory_order_relaxed),
+      .wasted = prefetch_wasted_.load(std::memory_order_relaxed),
+  };
+  std::lock_guard lock(prefetch_mutex_);
+  stats.window = readahead_.window();
+  return stats;
+}
+
+ChunkMetrics ChunkManager::metrics() const {
+  ChunkMetrics ret{
+      .load_latency = load_latency_.snapshot(),
+      .prefetch = prefetch_stats(),
+  };
+  for (auto &shard : shards_) {
+    ret.hits += shard.hits_.load();
+    ret.misses += shard.misses_.load();
+    ret.bytes_loaded += shard.bytes_loaded_.load();
+    ret.evictions += shard.evictions_.load();
+  }
+  return ret;
+}
+
+std::size_t ChunkManager::chunk_count() const {
+  std::size_t count = 0;
+  for (auto &shard : shards_) {
+    std::lock_guard lock(shard.mutex_);
+    count += shard.policy_->size();
+  }
+  return count;
+}
+
+// Bytes held by the data of `c`, a whole pool block even if it is short.
+static uint64_t data_bytes(const Chunk &c, uint64_t block_size) {
+  return c.data.capacity() == 0 ? 0 : block_size;
+}
+
+MemoryStats ChunkManager::memory_stats() const {
+  MemoryStats stats{.limit = chunk_memory_limit_,
+                    .pool_bytes = pool_.free_bytes(),
+                    .buffer_allocations = pool_.allocations()};
+  for (auto &shard : shards_) {
+    std::lock_guard lock(shard.mutex_);
+    stats.data_bytes += shard.bytes_;
+    stats.resident_chunks += shard.chunks_.size();
+    // a node holds the chunk, the key and the next pointer
+    stats.table_bytes +=
+        shard.chunks_.size() * (sizeof(Chunk) + 2 * sizeof(void *)) +
+        shard.chunks_.bucket_count() * sizeof(void *);
+    for (auto &[id, c] : shard.chunks_) {
+      if (c.pins_ != 0) {
+        stats.pinned_chunks++;
+        stats.pinned_bytes += data_bytes(c, pool_.block_size());
+      }
+    }
+  }
+  return stats;
+}
+
+template <typename F>
+Result<void> ChunkManager::touch_chunk(ChunkID id, F &&f) {
+  auto &shard = shard_of(id);
+
+  bool hit = false;
+  {
+    std::lock_guard lock(shard.mutex_);
+    auto iter = shard.chunks_.find(id);
+    if (iter != shard.chunks_.end()) {
+      auto &c = iter->second;
+      shard.policy_->touch(c);
+      if (c.prefetched_) {
+        c.prefetched_ = false;
+        prefetch_hits_.fetch_add(1, std::memory_order_relaxed);
+      }
+      f(c);
+      hit = true;
+    }
+  }
+  (hit ? shard.hits_ : shard.misses_).add();
+  if (prefetch_thread_.joinable()) {
+    readahead(id, !hit);
+  }
+  if (hit) {
+    return outcome::success();
+  }
+  prefetch_misses_.fetch_add(1, std::memory_order_relaxed);
+
+  // load without the lock so hits on the same shard don't wait for the disk
+  while (true) {
+    auto [offset, length] = chunk_range(id);
+    auto data = pool_.acquire();
+    {
+      ScopedLatency latency(load_latency_);
+      TRYV(loader_->read_chunk_into(offset, data.resize(length)));
+    }
+    shard.bytes_loaded_.add(length);
+
+    std::lock_guard lock(shard.mutex_);
+    auto *c = install(shard, id, std::move(data));
+    // the file grew while the last chunk was loading, it's short now
+    if (c == nullptr) {
+      continue;
+    }
+    f(*c);
     return outcome::success();
   }
+}
+
+Result<std::vector<ChunkHandle>> ChunkManager::load_chunks(
+    const std::vector<ChunkView> &views) {
+  std::vector<ChunkID> ids;
+  for (auto &v : views) {
+    auto &shard = shard_of(v.id_);
+    std::lock_guard lock(shard.mutex_);
+    if (!shard.chunks_.contains(v.id_)) {
+      ids.push_back(v.id_);
+    }
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  // a single miss is no batch, let get_chunk take it
+  if (ids.size() < 2) {
+    return std::vector<ChunkHandle>{};
+  }
 
-  auto s = chunk_size_;
-  auto offset = id * s;
-  auto length = std::min(s, static_cast<uint32_t>(loader_->size() - offset));
-  c.data = TRYX(loader_->read_chunk(offset, length));
+  std::vector<ChunkRange> ranges;
+  std::vector<ChunkBuffer> data;
+  std::vector<std::span<char>> outs;
+  ranges.reserve(ids.size());
+  data.reserve(ids.size());
+  outs.reserve(ids.size());
+  for (auto id : ids) {
+    ranges.push_back(chunk_range(id));
+    data.push_back(pool_.acquire());
+    outs.push_back(data.back().resize(ranges.back().length_));
+  }
+  {
+    ScopedLatency latency(load_latency_);
+    auto r = loader_->read_chunks_into(ranges, outs);
+    if (!r) {
+      if (r.error() == GenericErrc::state_not_recoverable) {
+        for (auto &d : data) {
+          d.leak();
+        }
+      }
+      return std::move(r).error();
+    }
+  }
+  prefetch_misses_.fetch_add(ids.size(), std::memory_order_relaxed);
+  for (std::size_t i = 0; i < ids.size(); i++) {
+    auto &shard = shard_of(ids[i]);
+    shard.misses_.add();
+    shard.bytes_loaded_.add(ranges[i].length_);
+  }
 
-  // trim LRU if necessary
-  while (lru_.size() * chunk_size_ > chunk_memory_limit_) {
-    auto &chunk = lru_.back();
-    chunk.reset();
-    lru_.pop_back();
+  std::vector<ChunkHandle> ret;
+  ret.reserve(ids.size());
+  for (std::size_t i = 0; i < ids.size(); i++) {
+    auto &shard = shard_of(ids[i]);
+    std::lock_guard lock(shard.mutex_);
+    auto *c = install(shard, ids[i], std::move(data[i]));
+    // a short last chunk left behind by growth, get_chunk reloads it
+    if (c == nullptr) {
+      continue;
+    }
+    c->pins_++;
+    ret.push_back(ChunkHandle(this, ids[i], c->data.view()));
+  }
+  if (prefetch_thread_.joinable()) {
+    for (auto id : ids) {
+      readahead(id, true);
+    }
   }
+  return ret;
+}
+
+ChunkRange ChunkManager::chunk_range(ChunkID id) const {
+  auto offset = uint64_t(id) * chunk_size_;
+  return ChunkRange{
+      .offset_ = offset,
+      .length_ = static_cast<uint32_t>(
+          std::min<uint64_t>(chunk_size_, size() - offset)),
+  };
+}
 
-  return outcome::success();
+Chunk *ChunkManager::install(Shard &shard, ChunkID id, ChunkBuffer &&data) {
+  Chunk *c = nullptr;
+  // another reader may have loaded it in the meantime
+  if (auto iter = shard.chunks_.find(id); iter != shard.chunks_.end()) {
+    c = &iter->second;
+    shard.policy_->touch(*c);
+  } else if (data.size() == chunk_range(id).length_) {
+    c = &emplace_chunk(shard, id, std::move(data));
+  } else {
+    return nullptr;
+  }
+  c->prefetched_ = false;
+  // the chunk just touched is always kept
+  trim(shard, c);
+  return c;
+}
+
+Chunk &ChunkManager::emplace_chunk(Shard &shard, ChunkID id,
+                                   ChunkBuffer &&data) {
+  auto &c = shard.chunks_[id];
+  c.id_ = id;
+  c.data = std::move(data);
+  shard.bytes_ += data_bytes(c, pool_.block_size());
+  shard.policy_->insert(c);
+  return c;
+}
+
+Result<uint64_t> ChunkManager::refresh() {
+  std::lock_guard refresh_lock(refresh_mutex_);
+  auto old_size = size();
+  auto new_size = TRYX(loader_->refresh_size());
+  if (new_size <= old_size) {
+    return old_size;
+  }
+  if (loader_->mapped()) {
+    size_.store(new_size, std::memory_order_release);
+    return new_size;
+  }
+
+  // the cached part of the old last chunk only needs the appended bytes
+  auto last = static_cast<ChunkID>(old_size / chunk_size_);
+  auto last_end = std::min<uint64_t>(uint64_t(last + 1) * chunk_size_,
+                                     new_size);
+  std::string tail;
+  if (old_size % chunk_size_ != 0) {
+    tail = TRYX(loader_->read_chunk(old_size, last_end - old_size));
+  }
+
+  // chunks past the old last one are out of reach until size_ grows, and
+  // loads of the last one check its length under this lock
+  auto &shard = shard_of(last);
+  std::lock_guard lock(shard.mutex_);
+  auto iter = shard.chunks_.find(last);
+  if (iter != shard.chunks_.end() && !tail.empty()) {
+    auto &c = iter->second;
+    c.data.append(tail);
+  }
+  size_.store(new_size, std::memory_order_release);
+  return new_size;
+}
+
+void ChunkManager::trim(Shard &shard, const Chunk *keep) {
+  while (shard.bytes_ > shard_memory_limit_) {
+    auto *victim = shard.policy_->victim(keep);
+    if (victim == nullptr) {
+      return;
+    }
+    auto &chunk = *victim;
+    shard.policy_->erase(chunk);
+    if (chunk.prefetched_) {
+      chunk.prefetched_ = false;
+      prefetch_wasted_.fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.bytes_ -= data_bytes(chunk, pool_.block_size());
+    shard.chunks_.erase(chunk.id_);
+    shard.evictions_.add();
+  }
+}
+
+void ChunkManager::unpin(ChunkID id) {
+  auto &shard = shard_of(id);
+  std::lock_guard lock(shard.mutex_);
+  auto iter = shard.chunks_.find(id);
+  assert(iter != shard.chunks_.end());
+  auto &c = iter->second;
+  assert(c.pins_ > 0);
+  // catch up on evictions skipped while the chunk was pinned
+  if (--c.pins_ == 0) {
+    trim(shard, nullptr);
+  }
+}
+
+void ChunkManager::readahead(ChunkID id, bool missed) {
+  // another hit on the chunk touched last changes nothing, which is most of
+  // the touches of a scan. A stale value only costs a missed step of the
+  // heuristic.
+  if (!missed && id == readahead_last_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  auto chunk_count = (size() + chunk_size_ - 1) / chunk_size_;
+  std::lock_guard lock(prefetch_mutex_);
+  readahead_last_.store(id, std::memory_order_relaxed);
+
+  // the reader is ahead of chunks still queued or loading
+  auto queued = std::find(prefetch_queue_.begin(), prefetch_queue_.end(), id);
+  bool caught_up = missed || id == prefetch_loading_;
+  if (queued != prefetch_queue_.end()) {
+    prefetch_queue_.erase(queued);
+    caught_up = true;
+  }
+
+  auto wasted = prefetch_wasted_.load(std::memory_order_relaxed);
+  if (wasted != seen_wasted_) {
+    seen_wasted_ = wasted;
+    readahead_.shrink();
+  }
+
+  auto req = readahead_.on_access(id, caught_up, ChunkID(chunk_count));
+  if (req.reset_) {
+    prefetch_queue_.clear();
+  }
+  if (req.count_ == 0) {
+    return;
+  }
+  for (uint32_t i = 0; i < req.count_; i++) {
+    prefetch_queue_.push_back(
+        ChunkID(int64_t(req.start_) + int64_t(i) * req.direction_));
+  }
+  prefetch_cv_.notify_one();
+}
+
+void ChunkManager::prefetch_loop() {
+  std::unique_lock lock(prefetch_mutex_);
+  while (true) {
+    prefetch_cv_.wait(lock, [&] { return stop_ || !prefetch_queue_.empty(); });
+    if (stop_) {
+      return;
+    }
+    auto id = prefetch_queue_.front();
+    prefetch_queue_.pop_front();
+    prefetch_loading_ = id;
+    lock.unlock();
+    prefetch_chunk(id);
+    lock.lock();
+    prefetch_loading_ = ReadaheadState::kNone;
+  }
+}
+
+void ChunkManager::prefetch_chunk(ChunkID id) {
+  auto &shard = shard_of(id);
+  {
+    std::lock_guard lock(shard.mutex_);
+    if (shard.chunks_.contains(id)) {
+      return;
+    }
+  }
+
+  auto [offset, length] = chunk_range(id);
+  auto data = pool_.acquire();
+  // speculative, a reader touching the chunk will report the error
+  {
+    ScopedLatency latency(load_latency_);
+    if (!loader_->read_chunk_into(offset, data.resize(length))) {
+      return;
+    }
+  }
+  shard.bytes_loaded_.add(length);
+
+  std::lock_guard lock(shard.mutex_);
+  if (shard.chunks_.contains(id) || data.size() != chunk_range(id).length_) {
+    return;
+  }
+  auto &c = emplace_chunk(shard, id, std::move(data));
+  c.prefetched_ = true;
+  trim(shard, &c);
+  prefetch_issued_.fetch_add(1, std::memory_order_relaxed);
 }
 
 }  // namespace oned
@@ -1,39 +1,249 @@
 #pragma once
 
 #include "chunk.hh"
+#include "eviction_policy.hh"
+#include "metrics.hh"
 #include "noncopyable.hh"
+#include "readahead.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 class ChunkManagerTest;
 
 namespace oned {
 
+struct ChunkManagerOptions {
+  // Chunks are striped across shards by id, each shard has its own lock,
+  // eviction policy and an equal share of the memory limit.
+  uint32_t shard_count = 1;
+  // Upper bound of chunks loaded ahead of a sequential reader on a background
+  // thread, 0 disables read-ahead. Mapped loaders rely on the kernel instead.
+  uint32_t max_readahead = 0;
+  // Which resident chunk gives way when a shard is full. two_q and arc keep
+  // chunks touched repeatedly, e.g. the viewport, through a one-off scan.
+  EvictionKind eviction = EvictionKind::lru;
+};
+
+struct PrefetchStats {
+  // chunks loaded by the read-ahead thread
+  uint64_t issued = 0;
+  // touches served by a chunk read-ahead had loaded
+  uint64_t hits = 0;
+  // touches that had to wait for the loader
+  uint64_t misses = 0;
+  // prefetched chunks evicted before anyone touched them
+  uint64_t wasted = 0;
+  // current read-ahead window in chunks
+  uint32_t window = 0;
+};
+
+struct MemoryStats {
+  // chunk_memory_limit as passed to the constructor
+  uint64_t limit = 0;
+  // heap bytes of resident chunk data, whole pool blocks even for short
+  // chunks, rounded up to the loader's alignment (4 KiB for direct I/O)
+  uint64_t data_bytes = 0;
+  // the chunk table, proportional to the resident chunks
+  uint64_t table_bytes = 0;
+  // evicted chunk buffers kept for the next misses, counted like
+  // data_bytes. The pool keeps at most an eighth of the limit and the
+  // chunks get the rest, so data_bytes + pool_bytes stays within it.
+  uint64_t pool_bytes = 0;
+  // chunk buffers ever allocated, flat once the cache is warm
+  uint64_t buffer_allocations = 0;
+  uint64_t resident_chunks = 0;
+  // pinned chunks can't be evicted and may push data_bytes past the limit
+  uint64_t pinned_chunks = 0;
+  uint64_t pinned_bytes = 0;
+};
+
+// All but `prefetch` stay zero unless built with ONED_METRICS. Mapped
+// loaders leave caching to the kernel and are not counted.
+struct ChunkMetrics {
+  // touches served from memory
+  uint64_t hits = 0;
+  // touches that waited for the loader
+  uint64_t misses = 0;
+  // by readers and read-ahead alike
+  uint64_t bytes_loaded = 0;
+  uint64_t evictions = 0;
+  // per loader call, a batch from get_chunks is one call
+  LatencySnapshot load_latency;
+  PrefetchStats prefetch;
+};
+
+class ChunkManager;
+
+// Keeps a chunk resident while held, the view is valid until release().
+class ChunkHandle : NonCopyable {
+public:
+  ChunkHandle() = default;
+  ChunkHandle(ChunkHandle &&other) noexcept;
+  ChunkHandle &operator=(ChunkHandle &&other) noexcept;
+  ~ChunkHandle();
+
+  std::string_view view() const {
+    return view_;
+  }
+
+  void release();
+
+private:
+  friend class ChunkManager;
+
+  ChunkHandle(ChunkManager *mgr, ChunkID id, std::string_view view)
+      : mgr_(mgr), id_(id), view_(view) {}
+
+  // null when nothing is pinned, e.g. for mapped loaders
+  ChunkManager *mgr_ = nullptr;
+  ChunkID id_ = 0;
+  std::string_view view_;
+};
+
 class ChunkManager : NonCopyable {
 public:
+  // `chunk_memory_limit` bounds the heap bytes of resident chunk data and
+  // of the buffers pooled for reuse, see MemoryStats.
   ChunkManager(ChunkLoaderPtr loader, uint32_t chunk_size,
-               uint64_t chunk_memory_limit);
+               uint64_t chunk_memory_limit, ChunkManagerOptions options = {});
+
+  // handles and the read-ahead thread point back at the manager
+  ChunkManager(ChunkManager &&) = delete;
+  ChunkManager &operator=(ChunkManager &&) = delete;
+  ~ChunkManager();
 
-  Result<std::string_view> get_chunk(ChunkView view);
+  // The chunk stays pinned while the handle lives, so a batch from
+  // get_chunks may exceed the memory limit until its handles are released.
+  Result<ChunkHandle> get_chunk(ChunkView view);
 
-  Result<std::vector<std::string_view>> get_chunks(
+  Result<std::vector<ChunkHandle>> get_chunks(
       const std::vector<ChunkView> &views);
 
-  std::size_t chunk_count() const {
-    return lru_.size();
+  // Copy the data out without pinning the chunk.
+  Result<std::string> read(ChunkView view);
+
+  std::size_t chunk_count() const;
+
+  uint64_t size() const {
+    return size_.load(std::memory_order_acquire);
   }
 
+  // Pick up data appended to the file since open or the last refresh: the
+  // chunk table grows and a cached partial last chunk gets the new bytes
+  // appended, views into it stay valid. Returns the new size.
+  Result<uint64_t> refresh();
+
+  uint32_t chunk_size() const {
+    return chunk_size_;
+  }
+
+  PrefetchStats prefetch_stats() const;
+
+  MemoryStats memory_stats() const;
+
+  ChunkMetrics metrics() const;
+
 private:
-  Result<void> touch_chunk(ChunkID id);
+  struct alignas(64) Shard {
+    mutable std::mutex mutex_;
+    // resident chunks only, map nodes never move while in the map
+    std::unordered_map<ChunkID, Chunk> chunks_;
+    // destroyed first, unlinking the chunks
+    std::unique_ptr<EvictionPolicy> policy_;
+    // data bytes of the chunks in chunks_
+    uint64_t bytes_ = 0;
+    // per shard so hits on different shards don't share a cache line,
+    // metrics() sums them up
+    Counter hits_;
+    Counter misses_;
+    Counter bytes_loaded_;
+    Counter evictions_;
+  };
+
+  Shard &shard_of(ChunkID id) {
+    return shards_[id % shards_.size()];
+  }
+
+  // Make the chunk resident and run `f` on it with the shard lock held.
+  template <typename F>
+  Result<void> touch_chunk(ChunkID id, F &&f);
+
+  // Pin and return whole-chunk handles for the chunks of `views` that were
+  // missing, all loaded with one read_chunks call.
+  Result<std::vector<ChunkHandle>> load_chunks(
+      const std::vector<ChunkView> &views);
 
-  using ChunkLRU = boost::intrusive::list<Chunk>;
+  ChunkRange chunk_range(ChunkID id) const;
+
+  // Pin a chunk that is known to be resident, e.g. pinned already.
+  ChunkHandle pin(ChunkID id);
+
+  // Make freshly loaded data resident, or touch the chunk if another reader
+  // was faster, shard lock held. Null when `data` is short of the chunk
+  // because the file grew meanwhile.
+  Chunk *install(Shard &shard, ChunkID id, ChunkBuffer &&data);
+  Chunk &emplace_chunk(Shard &shard, ChunkID id, ChunkBuffer &&data);
+
+  // Evict until the shard fits its limit, sparing `keep`.
+  void trim(Shard &shard, const Chunk *keep);
+
+  void unpin(ChunkID id);
+
+  void readahead(ChunkID id, bool missed);
+  void prefetch_loop();
+  void prefetch_chunk(ChunkID id);
 
   ChunkLoaderPtr loader_;
-  std::vector<Chunk> chunks_;
-  ChunkLRU lru_;
+  // size as of the last refresh, may lag behind the loader's
+  std::atomic<uint64_t> size_;
+  std::mutex refresh_mutex_;
+  // outlives the chunks in shards_
+  ChunkBufferPool pool_;
+  std::vector<Shard> shards_;
 
   uint32_t chunk_size_;
   uint64_t chunk_memory_limit_;
+  uint64_t shard_memory_limit_;
+
+  mutable std::mutex prefetch_mutex_;
+  std::condition_variable prefetch_cv_;
+  ReadaheadState readahead_;
+  // the id readahead_ saw last, read without the lock
+  std::atomic<ChunkID> readahead_last_{ReadaheadState::kNone};
+  std::deque<ChunkID> prefetch_queue_;
+  ChunkID prefetch_loading_ = ReadaheadState::kNone;
+  uint64_t seen_wasted_ = 0;
+  bool stop_ = false;
+  std::thread prefetch_thread_;
 
+  std::atomic<uint64_t> prefetch_issued_{0};
+  std::atomic<uint64_t> prefetch_hits_{0};
+  std::atomic<uint64_t> prefetch_misses_{0};
+  std::atomic<uint64_t> prefetch_wasted_{0};
+
+  LatencyHistogram load_latency_;
+
+  friend class ChunkHandle;
   friend class ::ChunkManagerTest;
 };
 
 }  // namespace oned
+
+template <>
+struct fmt::formatter<oned::ChunkMetrics> : fmt::formatter<std::string_view> {
+  template <typename FormatContext>
+  auto format(const oned::ChunkMetrics &m, FormatContext &ctx) const
+      -> decltype(ctx.out()) {
+    return fmt::format_to(
+        ctx.out(),
+        "hits={} misses={} bytes_loaded={} evictions={} load_latency=[{}] "
+        "prefetch_issued={} prefetch_hits={} prefetch_wasted={}",
+        m.hits, m.misses, m.bytes_loaded, m.evictions, m.load_latency,
+        m.prefetch.issued, m.prefetch.hits, m.prefetch.wasted);
+  }
+};
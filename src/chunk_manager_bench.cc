@@ -0,0 +1,172 @@
+#include "chunk_manager.hh"
+#include "file_util.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+
+using namespace oned;
+
+static constexpr uint32_t kChunkSize = 64 * 1024;
+
+// A log of ONED_BENCH_LOG_MB megabytes (64 by default) in the temp dir,
+// written on first use and removed at exit.
+class SyntheticLog {
+public:
+  SyntheticLog() {
+    uint64_t mb = 64;
+    if (const char *env = std::getenv("ONED_BENCH_LOG_MB")) {
+      mb = std::strtoull(env, nullptr, 10);
+    }
+    path_ = (std::filesystem::temp_directory_path() / "oned_bench.log")
+                .string();
+    std::mt19937_64 rng(42);
+    std::string data;
+    data.reserve(mb << 20);
+    for (uint64_t i = 0; data.size() < mb << 20; i++) {
+      data += fmt::format("2024-01-01T00:00:{:02}.{:06}Z INFO request {} ",
+                          i / 1'000'000 % 60, i % 1'000'000, i);
+      data.append(rng() % 120, 'x');
+      data += '\n';
+    }
+    if (!write_file_atomic(path_.c_str(), data)) {
+      std::abort();
+    }
+    size_ = data.size();
+  }
+
+  SyntheticLog(const SyntheticLog &) = delete;
+  SyntheticLog &operator=(const SyntheticLog &) = delete;
+
+  ~SyntheticLog() {
+    std::remove(path_.c_str());
+  }
+
+  const char *path() const {
+    return path_.c_str();
+  }
+
+  uint64_t size() const {
+    return size_;
+  }
+
+  ChunkID chunks() const {
+    return static_cast<ChunkID>((size_ + kChunkSize - 1) / kChunkSize);
+  }
+
+private:
+  std::string path_;
+  uint64_t size_;
+};
+
+static const SyntheticLog &synthetic_log() {
+  static const SyntheticLog log;
+  return log;
+}
+
+// Read through the chunk cache, mapped files would bypass it. Read-ahead
+// stays off, so every miss waits for the loader.
+static std::unique_ptr<ChunkManager> open_manager(
+    uint64_t memory_limit, EvictionKind eviction,
+    ChunkLoaderKind kind = ChunkLoaderKind::stdio) {
+  auto loader = ChunkLoader::open(synthetic_log().path(), {.kind = kind});
+  if (!loader) {
+    std::abort();
+  }
+  return std::make_unique<ChunkManager>(
+      std::move(loader).value(), kChunkSize, memory_limit,
+      ChunkManagerOptions{.eviction = eviction});
+}
+
+// Views of a read of `state.range(0)` bytes at an unaligned offset.
+static void BM_CalculateChunkViews(benchmark::State &state) {
+  auto length = static_cast<uint64_t>(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(calculate_chunk_views(12345, length, kChunkSize));
+  }
+}
+BENCHMARK(BM_CalculateChunkViews)->Arg(100)->Arg(1 << 20)->Arg(64 << 20);
+
+static ChunkView whole_chunk(ChunkID id) {
+  return ChunkView{.id_ = id, .offset_ = 0, .length_ = kChunkSize};
+}
+
+// Random reads of a file that fits in memory, all resident after warm-up.
+static void BM_GetChunkHit(benchmark::State &state) {
+  const auto &log = synthetic_log();
+  auto mgr = open_manager(log.size() * 2, EvictionKind::lru);
+  // the last chunk is partial, whole_chunk() would run past EOF
+  for (ChunkID id = 0; id < log.chunks() - 1; id++) {
+    (void)mgr->get_chunk(whole_chunk(id));
+  }
+  std::mt19937 rng(42);
+  for (auto _ : state) {
+    auto handle = mgr->get_chunk(whole_chunk(rng() % (log.chunks() - 1)));
+    benchmark::DoNotOptimize(handle);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * kChunkSize);
+}
+BENCHMARK(BM_GetChunkHit);
+
+// The same served from a mapping, for comparison.
+static void BM_GetChunkMapped(benchmark::State &state) {
+  const auto &log = synthetic_log();
+  auto mgr = open_manager(log.size() * 2, EvictionKind::lru,
+                          ChunkLoaderKind::mmap);
+  std::mt19937 rng(42);
+  for (auto _ : state) {
+    auto handle = mgr->get_chunk(whole_chunk(rng() % (log.chunks() - 1)));
+    benchmark::DoNotOptimize(handle);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * kChunkSize);
+}
+BENCHMARK(BM_GetChunkMapped);
+
+// A sequential scan through a cache of 16 chunks, every read loads one and
+// evicts one.
+static void BM_GetChunkMiss(benchmark::State &state) {
+  const auto &log = synthetic_log();
+  auto mgr = open_manager(16 * kChunkSize, EvictionKind::lru);
+  ChunkID id = 0;
+  for (auto _ : state) {
+    auto handle = mgr->get_chunk(whole_chunk(id));
+    benchmark::DoNotOptimize(handle);
+    id = (id + 1) % (log.chunks() - 1);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * kChunkSize);
+}
+BENCHMARK(BM_GetChunkMiss);
+
+// Skewed random reads over a file four times the cache, reports the share
+// served from memory per eviction policy.
+static void get_chunk_skewed(benchmark::State &state, EvictionKind kind) {
+  const auto &log = synthetic_log();
+  auto chunks = log.chunks() - 1;
+  auto mgr = open_manager(chunks / 4 * uint64_t(kChunkSize), kind);
+  std::mt19937 rng(42);
+  std::geometric_distribution<ChunkID> hot(8.0 / chunks);
+  for (auto _ : state) {
+    auto id = rng() % 4 == 0 ? rng() % chunks : hot(rng) % chunks;
+    auto handle = mgr->get_chunk(whole_chunk(id));
+    benchmark::DoNotOptimize(handle);
+  }
+  // every load counts as a miss, with or without read-ahead
+  auto misses = mgr->prefetch_stats().misses;
+  state.counters["hit_ratio"] =
+      1 - double(misses) / double(state.iterations());
+  state.SetBytesProcessed(int64_t(state.iterations()) * kChunkSize);
+}
+
+static const bool registered = [] {
+  for (auto [name, kind] : {std::pair{"lru", EvictionKind::lru},
+                            {"two_q", EvictionKind::two_q},
+                            {"arc", EvictionKind::arc}}) {
+    benchmark::RegisterBenchmark(
+        fmt::format("BM_GetChunkSkewed/{}", name).c_str(), get_chunk_skewed,
+        kind);
+  }
+  return true;
+}();
@@ -0,0 +1,124 @@
+#include "chunk_manager.hh"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <random>
+#include <thread>
+
+using namespace oned;
+
+class CountingChunkLoader final : public ChunkLoader, NonCopyable {
+public:
+  explicit CountingChunkLoader(std::string data) : data_(std::move(data)) {}
+
+  uint64_t size() const final {
+    return data_.size();
+  }
+
+  Result<std::string> read_chunk(uint64_t offset, uint32_t length) final {
+    if (offset > data_.size()) {
+      return GenericErrc::invalid_argument;
+    }
+    reads_.fetch_add(1, std::memory_order_relaxed);
+    return data_.substr(offset, length);
+  }
+
+  uint64_t reads() const {
+    return reads_.load();
+  }
+
+private:
+  std::string data_;
+  std::atomic<uint64_t> reads_{0};
+};
+
+static std::string make_data(std::size_t size) {
+  std::string data(size, '\0');
+  for (std::size_t i = 0; i < size; i++) {
+    data[i] = static_cast<char>('a' + (i * 7 + i / 13) % 26);
+  }
+  return data;
+}
+
+static void run_readers(ChunkManager& mgr, const std::string& data,
+                        uint64_t chunk_size, int threads, int iterations) {
+  std::atomic<int> failures{0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::mt19937_64 rng(t);
+      std::uniform_int_distribution<uint64_t> offset_dist(0, data.size() - 1);
+      std::uniform_int_distribution<uint64_t> length_dist(1, chunk_size * 3);
+      for (int i = 0; i < iterations; i++) {
+        auto offset = offset_dist(rng);
+        auto length = std::min(length_dist(rng), data.size() - offset);
+        auto views = calculate_chunk_views(offset, length, chunk_size);
+        if (i % 2 == 0) {
+          for (auto& v : views) {
+            auto str = mgr.read(v);
+            auto expected = std::string_view(data).substr(
+                v.id_ * chunk_size + v.offset_, v.length_);
+            if (!str || str.value() != expected) {
+              failures.fetch_add(1);
+            }
+          }
+          continue;
+        }
+        // pinned views must survive evictions done by the other readers
+        auto handles = mgr.get_chunks(views);
+        if (!handles) {
+          failures.fetch_add(1);
+          continue;
+        }
+        std::string joined;
+        for (auto& h : handles.value()) {
+          joined.append(h.view());
+        }
+        if (joined != std::string_view(data).substr(offset, length)) {
+          failures.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  ASSERT_EQ(failures.load(), 0);
+}
+
+TEST(ChunkManagerStress, concurrent_reads_with_eviction) {
+  static constexpr uint32_t chunk_size = 64;
+  auto data = make_data(chunk_size * 256 + 17);
+  ChunkManager mgr(std::make_unique<CountingChunkLoader>(data), chunk_size,
+                   chunk_size * 32, {.shard_count = 8});
+  run_readers(mgr, data, chunk_size, 8, 20000);
+  ASSERT_LE(mgr.chunk_count(), 32);
+}
+
+TEST(ChunkManagerStress, concurrent_hits) {
+  static constexpr uint32_t chunk_size = 64;
+  auto data = make_data(chunk_size * 64);
+  auto loader = std::make_unique<CountingChunkLoader>(data);
+  auto& counting = *loader;
+  // room for every chunk next to the pool's share of the limit
+  ChunkManager mgr(std::move(loader), chunk_size, data.size() * 2,
+                   {.shard_count = 16});
+  run_readers(mgr, data, chunk_size, 1, 2000);
+  auto cold_reads = counting.reads();
+  ASSERT_EQ(cold_reads, 64);
+
+  // everything is resident now, the readers must never hit the loader
+  run_readers(mgr, data, chunk_size, 8, 20000);
+  ASSERT_EQ(counting.reads(), cold_reads);
+  ASSERT_EQ(mgr.chunk_count(), 64);
+}
+
+TEST(ChunkManagerStress, single_shard) {
+  static constexpr uint32_t chunk_size = 32;
+  auto data = make_data(chunk_size * 100 + 5);
+  ChunkManager mgr(std::make_unique<CountingChunkLoader>(data), chunk_size,
+                   chunk_size * 4);
+  run_readers(mgr, data, chunk_size, 4, 5000);
+  ASSERT_LE(mgr.chunk_count(), 4);
+}
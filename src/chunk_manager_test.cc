@@ -1,7 +1,15 @@
 #include "chunk_manager.hh"
+#include "io_uring_chunk_loader.hh"
 
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <thread>
+
 using namespace oned;
 
 class TestChunkLoader final : public ChunkLoader, NonCopyable {
@@ -111,91 +119,143 @@ protected:
                                           memory_limit);
   }
 
+  // data of the resident chunks, the ones kept longest first
+  std::vector<std::string> resident() const {
+    std::vector<std::string> ret;
+    mgr_->shards_[0].policy_->for_each(
+        [&](const Chunk& c) { ret.emplace_back(c.data.view()); });
+    return ret;
+  }
+
   void test_lru() {
     ASSERT_EQ(mgr_->chunk_count(), 0);
 
     // touch A lru: A
-    auto chunk1 = mgr_->get_chunk(ChunkView{0, 0, 10});
+    auto chunk1 = mgr_->read(ChunkView{0, 0, 10});
     ASSERT_TRUE(chunk1);
     ASSERT_EQ(chunk1.value(), std::string(10, 'A'));
     ASSERT_EQ(mgr_->chunk_count(), 1);
 
     // touch B lru: B A
-    auto chunk2 = mgr_->get_chunk(ChunkView{1, 0, 10});
+    auto chunk2 = mgr_->read(ChunkView{1, 0, 10});
     ASSERT_TRUE(chunk2);
     ASSERT_EQ(chunk2.value(), std::string(10, 'B'));
     ASSERT_EQ(mgr_->chunk_count(), 2);
 
     // touch C lru: C B A
-    auto chunk3 = mgr_->get_chunk(ChunkView{2, 0, 10});
+    auto chunk3 = mgr_->read(ChunkView{2, 0, 10});
     ASSERT_TRUE(chunk3);
     ASSERT_EQ(chunk3.value(), std::string(10, 'C'));
     ASSERT_EQ(mgr_->chunk_count(), 3);
 
     {
       // touch A lru: A C B
-      auto chunk = mgr_->get_chunk(ChunkView{0, 0, 10});
+      auto chunk = mgr_->read(ChunkView{0, 0, 10});
       ASSERT_TRUE(chunk);
       ASSERT_EQ(chunk.value(), std::string(10, 'A'));
       ASSERT_EQ(mgr_->chunk_count(), 3);
 
       // lru: A C B
-      auto p = mgr_->lru_.begin();
-      ASSERT_EQ(p->data, std::string(10, 'A'));
+      auto lru = resident();
+      auto p = lru.begin();
+      ASSERT_EQ(*p, std::string(10, 'A'));
       ++p;
-      ASSERT_EQ(p->data, std::string(10, 'C'));
+      ASSERT_EQ(*p, std::string(10, 'C'));
       ++p;
-      ASSERT_EQ(p->data, std::string(10, 'B'));
+      ASSERT_EQ(*p, std::string(10, 'B'));
     }
 
     // touch D evict B lru: D A C
-    auto chunk4 = mgr_->get_chunk(ChunkView{3, 0, 10});
+    auto chunk4 = mgr_->read(ChunkView{3, 0, 10});
     ASSERT_TRUE(chunk4);
     ASSERT_EQ(chunk4.value(), std::string(10, 'D'));
     ASSERT_EQ(mgr_->chunk_count(), 3);
-    for (auto& c : mgr_->lru_) {
-      ASSERT_NE(c.data, std::string(10, 'B'));
+    for (auto& data : resident()) {
+      ASSERT_NE(data, std::string(10, 'B'));
     }
 
     // touch A lru: A D C
-    chunk1 = mgr_->get_chunk(ChunkView{0, 0, 10});
+    chunk1 = mgr_->read(ChunkView{0, 0, 10});
     ASSERT_TRUE(chunk1);
     ASSERT_EQ(chunk1.value(), std::string(10, 'A'));
     ASSERT_EQ(mgr_->chunk_count(), 3);
     {
       // lru: A D C
-      auto p = mgr_->lru_.begin();
-      ASSERT_EQ(p->data, std::string(10, 'A'));
+      auto lru = resident();
+      auto p = lru.begin();
+      ASSERT_EQ(*p, std::string(10, 'A'));
       ++p;
-      ASSERT_EQ(p->data, std::string(10, 'D'));
+      ASSERT_EQ(*p, std::string(10, 'D'));
       ++p;
-      ASSERT_EQ(p->data, std::string(10, 'C'));
+      ASSERT_EQ(*p, std::string(10, 'C'));
     }
 
     // touch E evict C lru: E A D
-    auto chunk5 = mgr_->get_chunk(ChunkView{4, 0, 10});
+    auto chunk5 = mgr_->read(ChunkView{4, 0, 10});
     ASSERT_TRUE(chunk5);
     ASSERT_EQ(chunk5.value(), std::string(10, 'E'));
     ASSERT_EQ(mgr_->chunk_count(), 3);
-    for (auto& c : mgr_->lru_) {
-      ASSERT_NE(c.data, std::string(10, 'C'));
+    for (auto& data : resident()) {
+      ASSERT_NE(data, std::string(10, 'C'));
     }
 
     // touch B evict D lru: B E A
-    chunk2 = mgr_->get_chunk(ChunkView{1, 0, 10});
+    chunk2 = mgr_->read(ChunkView{1, 0, 10});
     ASSERT_TRUE(chunk2);
     ASSERT_EQ(chunk2.value(), std::string(10, 'B'));
     ASSERT_EQ(mgr_->chunk_count(), 3);
-    for (auto& c : mgr_->lru_) {
-      ASSERT_NE(c.data, std::string(10, 'D'));
+    for (auto& data : resident()) {
+      ASSERT_NE(data, std::string(10, 'D'));
     }
 
     // touch F evict E lru: F B A
-    auto chunk6 = mgr_->get_chunk(ChunkView{5, 0, 5});
+    auto chunk6 = mgr_->read(ChunkView{5, 0, 5});
     ASSERT_TRUE(chunk6);
     ASSERT_EQ(chunk6.value(), std::string(5, 'F'));
   }
 
+  void test_pin() {
+    // pin A, then stream B C D E through the cache
+    auto a = mgr_->get_chunk(ChunkView{0, 2, 5});
+    ASSERT_TRUE(a);
+    ASSERT_EQ(a.value().view(), std::string(5, 'A'));
+    for (ChunkID id = 1; id < 5; id++) {
+      auto chunk = mgr_->get_chunk(ChunkView{id, 0, 10});
+      ASSERT_TRUE(chunk);
+      ASSERT_EQ(chunk.value().view(), std::string(10, 'A' + id));  // NOLINT
+    }
+    ASSERT_EQ(mgr_->chunk_count(), 3);
+    ASSERT_EQ(mgr_->shards_[0].chunks_.at(0).data.view(),
+              std::string(10, 'A'));
+    ASSERT_EQ(a.value().view(), std::string(5, 'A'));
+
+    // once released, A is the first to go
+    a.value().release();
+    ASSERT_TRUE(a.value().view().empty());
+    ASSERT_TRUE(mgr_->read(ChunkView{1, 0, 10}));
+    ASSERT_EQ(mgr_->chunk_count(), 3);
+    ASSERT_FALSE(mgr_->shards_[0].chunks_.contains(0));
+  }
+
+  void test_batch_over_limit() {
+    auto views = calculate_chunk_views(3, 50, chunk_size);
+    ASSERT_EQ(views.size(), 6);
+    auto handles = mgr_->get_chunks(views);
+    ASSERT_TRUE(handles);
+    // every chunk of the batch stays resident while the handles live
+    ASSERT_EQ(mgr_->chunk_count(), 6);
+    std::string joined;
+    for (auto& h : handles.value()) {
+      joined.append(h.view());
+    }
+    ASSERT_EQ(joined, "AAAAAAA" + std::string(10, 'B') + std::string(10, 'C') +
+                          std::string(10, 'D') + std::string(10, 'E') +
+                          "FFF");
+
+    handles.value().clear();
+    ASSERT_LE(mgr_->chunk_count(), 3);
+  }
+
   std::unique_ptr<ChunkManager> mgr_;
   static constexpr uint32_t chunk_size = 10;
   static constexpr uint64_t memory_limit = 30;
@@ -204,3 +264,413 @@ protected:
 TEST_F(ChunkManagerTest, memory_limit_and_lru) {
   test_lru();
 }
+
+TEST_F(ChunkManagerTest, pinned_chunks_are_not_evicted) {
+  test_pin();
+}
+
+TEST_F(ChunkManagerTest, batch_larger_than_limit) {
+  test_batch_over_limit();
+}
+
+TEST(ChunkManager, memory_stats) {
+  // the last chunk is short but reserves room to grow into a full one
+  auto loader = std::make_unique<TestChunkLoader>(std::string(1000, 'x'));
+  ChunkManager mgr(std::move(loader), 256, 600);
+  for (auto& v : calculate_chunk_views(0, 1000, 256)) {
+    ASSERT_TRUE(mgr.read(v));
+    auto stats = mgr.memory_stats();
+    ASSERT_LE(stats.data_bytes + stats.pool_bytes, stats.limit);
+  }
+  auto stats = mgr.memory_stats();
+  ASSERT_EQ(stats.limit, 600);
+  ASSERT_EQ(stats.data_bytes, 512);
+  ASSERT_EQ(stats.resident_chunks, 2);
+  ASSERT_GT(stats.table_bytes, 0);
+  ASSERT_EQ(stats.pinned_chunks, 0);
+
+  auto handle = mgr.get_chunk(ChunkView{3, 0, 232});
+  ASSERT_TRUE(handle);
+  stats = mgr.memory_stats();
+  ASSERT_EQ(stats.pinned_chunks, 1);
+  ASSERT_EQ(stats.pinned_bytes, 256);
+  handle.value().release();
+
+  // evicted buffers serve the next misses, the pool's eighth of the limit
+  // is taken off the chunks
+  ChunkManager pooled(std::make_unique<TestChunkLoader>(std::string(10240, 'x')),
+                      256, 4096);
+  uint64_t allocations = 0;
+  for (int pass = 0; pass < 10; pass++) {
+    for (auto& v : calculate_chunk_views(0, 10240, 256)) {
+      ASSERT_TRUE(pooled.read(v));
+      stats = pooled.memory_stats();
+      ASSERT_LE(stats.data_bytes + stats.pool_bytes, stats.limit);
+    }
+    if (pass == 0) {
+      allocations = stats.buffer_allocations;
+    }
+  }
+  stats = pooled.memory_stats();
+  ASSERT_EQ(stats.buffer_allocations, allocations);
+  ASSERT_GT(stats.pool_bytes, 0);
+  ASSERT_EQ(stats.data_bytes, 4096 - 512);
+}
+
+TEST(ChunkManager, metrics) {
+  if (!kMetricsEnabled) {
+    GTEST_SKIP() << "built without ONED_METRICS";
+  }
+  // room for two chunks out of four
+  auto loader = std::make_unique<TestChunkLoader>(std::string(1000, 'x'));
+  ChunkManager mgr(std::move(loader), 256, 600);
+  auto views = calculate_chunk_views(0, 1000, 256);
+  ASSERT_TRUE(mgr.read(views[0]));
+  ASSERT_TRUE(mgr.read(views[0]));
+  ASSERT_TRUE(mgr.read(views[1]));
+  ASSERT_TRUE(mgr.read(views[2]));
+  ASSERT_TRUE(mgr.read(views[3]));
+
+  auto metrics = mgr.metrics();
+  EXPECT_EQ(metrics.hits, 1);
+  EXPECT_EQ(metrics.misses, 4);
+  EXPECT_EQ(metrics.bytes_loaded, 1000);
+  EXPECT_EQ(metrics.evictions, 2);
+  EXPECT_EQ(metrics.load_latency.count, 4);
+  EXPECT_LE(metrics.load_latency.p50_ns, metrics.load_latency.max_ns);
+  EXPECT_EQ(metrics.prefetch.misses, 4);
+
+  // a cold batch is all misses, loaded with one call
+  ChunkManager batch(std::make_unique<TestChunkLoader>(std::string(1000, 'x')),
+                     256, 600);
+  auto handles = batch.get_chunks(views);
+  ASSERT_TRUE(handles);
+  metrics = batch.metrics();
+  EXPECT_EQ(metrics.hits, 0);
+  EXPECT_EQ(metrics.misses, 4);
+  EXPECT_EQ(metrics.load_latency.count, 1);
+  handles = batch.get_chunks({views[1], views[1], views[2]});
+  ASSERT_TRUE(handles);
+  EXPECT_EQ(batch.metrics().hits, 3);
+}
+
+static std::string write_temp_file(const char* name, const std::string& data) {
+  auto path = ::testing::TempDir() + name;
+  auto* f = std::fopen(path.c_str(), "wb");
+  EXPECT_NE(f, nullptr);
+  std::fwrite(data.data(), 1, data.size(), f);
+  std::fclose(f);
+  return path;
+}
+
+TEST(MmapChunkLoader, views_without_cache) {
+  std::string test_data;
+  for (int i = 0; i < 5; i++) {
+    test_data += std::string(10, 'a' + i);  // NOLINT
+  }
+  auto path = write_temp_file("mmap_chunk_loader", test_data);
+
+  auto loader = ChunkLoader::open(
+      path.c_str(), {.kind = ChunkLoaderKind::mmap,
+                     .access = AccessHint::sequential});
+  ASSERT_TRUE(loader);
+  ASSERT_TRUE(loader.value()->mapped());
+  ASSERT_EQ(loader.value()->size(), test_data.size());
+
+  ChunkManager mgr(std::move(loader).value(), 10, 20);
+  for (auto& v : calculate_chunk_views(5, 40, 10)) {
+    auto chunk = mgr.get_chunk(v);
+    ASSERT_TRUE(chunk);
+    ASSERT_EQ(chunk.value().view(),
+              std::string_view(test_data).substr(v.id_ * 10 + v.offset_,
+                                                 v.length_));
+  }
+  ASSERT_EQ(mgr.chunk_count(), 0);
+
+  auto stdio = ChunkLoader::open(path.c_str(),
+                                 {.kind = ChunkLoaderKind::stdio});
+  ASSERT_TRUE(stdio);
+  ASSERT_FALSE(stdio.value()->mapped());
+  std::remove(path.c_str());
+}
+
+TEST(ReadaheadState, sequential_and_reverse_runs) {
+  ReadaheadState ra(8);
+  // the first touch only records the position
+  auto req = ra.on_access(10, true, 100);
+  ASSERT_EQ(req.count_, 0);
+
+  // forward run, top the window up to 2 chunks ahead
+  req = ra.on_access(11, false, 100);
+  ASSERT_EQ(req.start_, 12);
+  ASSERT_EQ(req.count_, 2);
+  ASSERT_EQ(req.direction_, 1);
+  req = ra.on_access(12, false, 100);
+  ASSERT_EQ(req.start_, 14);
+  ASSERT_EQ(req.count_, 1);
+
+  // the reader caught up, the window doubles
+  req = ra.on_access(13, true, 100);
+  ASSERT_EQ(ra.window(), 4);
+  ASSERT_EQ(req.start_, 15);
+  ASSERT_EQ(req.count_, 3);
+  ra.on_access(14, true, 100);
+  ra.on_access(15, true, 100);
+  ASSERT_EQ(ra.window(), 8);
+  ra.shrink();
+  ASSERT_EQ(ra.window(), 4);
+
+  // turning around starts a new run
+  req = ra.on_access(14, false, 100);
+  ASSERT_TRUE(req.reset_);
+  ASSERT_EQ(req.start_, 13);
+  ASSERT_EQ(req.count_, 2);
+  ASSERT_EQ(req.direction_, -1);
+
+  // stops at the first chunk
+  ReadaheadState back(8);
+  back.on_access(2, false, 100);
+  req = back.on_access(1, false, 100);
+  ASSERT_EQ(req.start_, 0);
+  ASSERT_EQ(req.count_, 1);
+
+  // random access disables read-ahead
+  req = ra.on_access(50, false, 100);
+  ASSERT_EQ(req.count_, 0);
+  ASSERT_EQ(ra.window(), 0);
+}
+
+TEST(ChunkManagerReadahead, sequential_scan) {
+  std::string test_data;
+  for (int i = 0; i < 200; i++) {
+    test_data += std::string(10, 'a' + i % 26);  // NOLINT
+  }
+  ChunkManager mgr(std::make_unique<TestChunkLoader>(test_data), 10, 400,
+                   {.max_readahead = 8});
+  for (ChunkID id = 0; id < 200; id++) {
+    auto str = mgr.read(ChunkView{id, 0, 10});
+    ASSERT_TRUE(str);
+    ASSERT_EQ(str.value(), std::string(10, 'a' + id % 26));  // NOLINT
+    // Read-ahead starts with the second chunk and loads in order, so once
+    // `id` chunks are issued the next one is resident. Wait for that
+    // instead of for some amount of time.
+    if (id == 0 || id == 199) {
+      continue;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (mgr.prefetch_stats().issued < id &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+    ASSERT_GE(mgr.prefetch_stats().issued, id);
+  }
+  // only the first two chunks were ever waited for
+  auto stats = mgr.prefetch_stats();
+  ASSERT_EQ(stats.issued, 198);
+  ASSERT_EQ(stats.hits, 198);
+  ASSERT_EQ(stats.misses, 2);
+  ASSERT_LE(mgr.chunk_count(), 40);
+}
+
+static void test_batch_reads(bool use_io_uring) {
+  std::string test_data;
+  for (int i = 0; i < 1000; i++) {
+    test_data += std::string(64, 'a' + i % 26);  // NOLINT
+  }
+  test_data += "tail";
+  auto path = write_temp_file("io_uring_chunk_loader", test_data);
+  auto loader = open_io_uring_loader(path.c_str(), use_io_uring);
+  ASSERT_TRUE(loader);
+
+  // scattered, adjacent, duplicated and the short last chunk
+  std::vector<ChunkRange> ranges;
+  for (uint64_t i : {900, 3, 4, 5, 500, 4, 0, 999, 1000}) {
+    ranges.push_back(ChunkRange{
+        .offset_ = i * 64,
+        .length_ = static_cast<uint32_t>(
+            std::min<uint64_t>(64, test_data.size() - i * 64)),
+    });
+  }
+  auto data = loader.value()->read_chunks(ranges);
+  ASSERT_TRUE(data);
+  ASSERT_EQ(data.value().size(), ranges.size());
+  for (std::size_t i = 0; i < ranges.size(); i++) {
+    ASSERT_EQ(data.value()[i], test_data.substr(ranges[i].offset_,
+                                                ranges[i].length_));
+  }
+
+  // a batch beyond EOF fails as a whole
+  ranges.push_back(ChunkRange{.offset_ = test_data.size(), .length_ = 64});
+  ASSERT_FALSE(loader.value()->read_chunks(ranges));
+
+  ChunkManager mgr(std::move(loader).value(), 64, 64 * 8, {.shard_count = 2});
+  auto views = calculate_chunk_views(100, 64 * 20, 64);
+  auto handles = mgr.get_chunks(views);
+  ASSERT_TRUE(handles);
+  std::string joined;
+  for (auto& h : handles.value()) {
+    joined.append(h.view());
+  }
+  ASSERT_EQ(joined, test_data.substr(100, 64 * 20));
+  ASSERT_EQ(mgr.prefetch_stats().misses, views.size());
+  std::remove(path.c_str());
+}
+
+TEST(IoUringChunkLoader, batch_reads) {
+  test_batch_reads(true);
+}
+
+TEST(IoUringChunkLoader, preadv_fallback) {
+  test_batch_reads(false);
+}
+
+TEST(IoUringChunkLoader, enter_failure) {
+#ifndef ONED_FAULT_INJECTION
+  GTEST_SKIP() << "built without ONED_FAULT_INJECTION";
+#else
+  std::string test_data;
+  for (int i = 0; i < 1000; i++) {
+    test_data += std::string(64, 'a' + i % 26);  // NOLINT
+  }
+  auto path = write_temp_file("io_uring_enter_failure", test_data);
+  auto loader = open_io_uring_loader(path.c_str());
+  ASSERT_TRUE(loader);
+
+  // more ranges than the ring holds, so the failure hits a later batch while
+  // the first one is still in flight
+  std::vector<ChunkRange> ranges;
+  for (uint64_t i = 0; i < 1000; i += 3) {
+    ranges.push_back(ChunkRange{.offset_ = i * 64, .length_ = 64});
+  }
+  std::vector<std::string> data(ranges.size());
+  std::vector<std::span<char>> outs(ranges.size());
+  for (std::size_t i = 0; i < ranges.size(); i++) {
+    data[i].resize(64);
+    outs[i] = data[i];
+  }
+  inject_io_uring_enter_error(EIO, 1);
+  auto r = loader.value()->read_chunks_into(ranges, outs);
+  if (r) {
+    inject_io_uring_enter_error(0, 0, 0);
+    std::remove(path.c_str());
+    GTEST_SKIP() << "io_uring is not available";
+  }
+
+  // nothing still writes into the buffers of the failed batch, and none of
+  // its reads leak into the next one
+  for (auto& d : data) {
+    std::fill(d.begin(), d.end(), '\0');
+  }
+  auto again = loader.value()->read_chunks(ranges);
+  ASSERT_TRUE(again);
+  for (std::size_t i = 0; i < ranges.size(); i++) {
+    ASSERT_EQ(again.value()[i], test_data.substr(ranges[i].offset_, 64));
+    ASSERT_EQ(data[i], std::string(64, '\0'));
+  }
+
+  // transient errors are retried
+  inject_io_uring_enter_error(EAGAIN, 0, 3);
+  again = loader.value()->read_chunks(ranges);
+  ASSERT_TRUE(again);
+  ASSERT_EQ(again.value()[10], test_data.substr(ranges[10].offset_, 64));
+  inject_io_uring_enter_error(EBUSY, 2, 3);
+  again = loader.value()->read_chunks(ranges);
+  ASSERT_TRUE(again);
+  ASSERT_EQ(again.value().back(), test_data.substr(ranges.back().offset_, 64));
+  std::remove(path.c_str());
+#endif
+}
+
+TEST(IoUringChunkLoader, enter_failure_with_reads_in_flight) {
+#ifndef ONED_FAULT_INJECTION
+  GTEST_SKIP() << "built without ONED_FAULT_INJECTION";
+#else
+  // a fifo with data for one read only keeps the other in flight
+  auto path = ::testing::TempDir() + "io_uring_enter_in_flight";
+  std::remove(path.c_str());
+  ASSERT_EQ(mkfifo(path.c_str(), 0600), 0);
+  int writer = -1;
+  std::thread open_writer([&] { writer = ::open(path.c_str(), O_WRONLY); });
+  auto loader = open_io_uring_loader(path.c_str());
+  open_writer.join();
+  ASSERT_TRUE(loader);
+  ASSERT_NE(writer, -1);
+  ASSERT_EQ(write(writer, std::string(64, 'x').data(), 64), 64);
+
+  std::vector<ChunkRange> ranges{{.offset_ = 0, .length_ = 64},
+                                 {.offset_ = 64, .length_ = 64}};
+  inject_io_uring_enter_error(EIO, 1, 2);
+  auto r = loader.value()->read_chunks(ranges);
+  inject_io_uring_enter_error(0, 0, 0);
+  if (r) {
+    close(writer);
+    std::remove(path.c_str());
+    GTEST_SKIP() << "io_uring is not available";
+  }
+  // the ring and the buffers are given up instead of waiting, the read still
+  // in flight lands in them
+  ASSERT_EQ(r.error(), GenericErrc::state_not_recoverable);
+  ASSERT_EQ(write(writer, std::string(64, 'y').data(), 64), 64);
+  close(writer);
+  std::remove(path.c_str());
+#endif
+}
+
+TEST(DirectChunkLoader, unaligned_reads_and_growth) {
+  std::string test_data;
+  for (int i = 0; i < 5 * 4096 + 123; i++) {
+    test_data += static_cast<char>('a' + i * 7 % 26);  // NOLINT
+  }
+  auto path = write_temp_file("direct_chunk_loader", test_data);
+  auto loader = ChunkLoader::open(path.c_str(),
+                                  {.kind = ChunkLoaderKind::direct});
+  ASSERT_TRUE(loader);
+  ASSERT_EQ(loader.value()->size(), test_data.size());
+
+  for (auto [offset, length] : {std::pair<uint64_t, uint32_t>{0, 4096},
+                                {4096, 8192},
+                                {1, 10},
+                                {4000, 200},
+                                {5 * 4096, 123},
+                                {5 * 4096 + 100, 23}}) {
+    auto data = loader.value()->read_chunk(offset, length);
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value(), test_data.substr(offset, length));
+  }
+  ASSERT_FALSE(loader.value()->read_chunk(5 * 4096, 200));
+
+  // pooled buffers take the aligned path
+  ChunkManager mgr(std::move(loader).value(), 4096, 4096 * 2);
+  for (auto& v : calculate_chunk_views(10, test_data.size() - 10, 4096)) {
+    auto chunk = mgr.read(v);
+    ASSERT_TRUE(chunk);
+    ASSERT_EQ(chunk.value(),
+              test_data.substr(v.id_ * 4096 + v.offset_, v.length_));
+  }
+
+  auto* f = std::fopen(path.c_str(), "ab");
+  ASSERT_NE(f, nullptr);
+  std::fwrite("appended", 1, 8, f);
+  std::fclose(f);
+  test_data += "appended";
+  auto size = mgr.refresh();
+  ASSERT_TRUE(size);
+  ASSERT_EQ(size.value(), test_data.size());
+  auto tail = mgr.read(ChunkView{5, 0, 131});
+  ASSERT_TRUE(tail);
+  ASSERT_EQ(tail.value(), test_data.substr(5 * 4096));
+
+  // an unaligned chunk size still takes whole aligned blocks
+  loader = ChunkLoader::open(path.c_str(), {.kind = ChunkLoaderKind::direct});
+  ASSERT_TRUE(loader);
+  ChunkManager unaligned(std::move(loader).value(), 1000, 4096 * 4);
+  for (auto& v : calculate_chunk_views(0, test_data.size(), 1000)) {
+    ASSERT_TRUE(unaligned.read(v));
+    auto stats = unaligned.memory_stats();
+    ASSERT_LE(stats.data_bytes + stats.pool_bytes, stats.limit);
+  }
+  auto stats = unaligned.memory_stats();
+  ASSERT_EQ(stats.resident_chunks, 4);
+  ASSERT_EQ(stats.data_bytes, 4 * 4096);
+  std::remove(path.c_str());
+}
@@ -0,0 +1,663 @@
+#include "compressed_chunk_loader.hh"
+#include "file_util.hh"
+#include "index_file.hh"
+#include "noncopyable.hh"
+#include "serde.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef ONED_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <mutex>
+
+namespace oned {
+
+static constexpr uint32_t kWindowSize = 32768;
+static constexpr uint32_t kInputSize = 65536;
+static constexpr uint32_t kIndexVersion = 2;
+
+enum class CompressedFormat : uint8_t {
+  unknown,
+  gzip,
+  zstd,
+};
+
+struct SeekPoint {
+  uint64_t out_;
+  uint64_t in_;
+  // bits of the byte before `in_` that belong to the deflate block
+  uint8_t bits_;
+  // deflated copy of the inflate history preceding `out_`
+  std::string window_;
+};
+
+// the IndexSection::seek_index of an index file
+struct SeekIndex {
+  uint8_t format_;
+  uint64_t size_;
+  uint64_t span_;
+  std::vector<SeekPoint> points_;
+};
+
+static Result<uint64_t> read_at(int fd, void* buf, uint64_t length,
+                                uint64_t offset) {
+  while (true) {
+    auto n = pread(fd, buf, length, static_cast<off_t>(offset));
+    if (n >= 0) {
+      return static_cast<uint64_t>(n);
+    }
+    if (errno != EINTR) {
+      return errno_to_errc(errno);
+    }
+  }
+}
+
+static CompressedFormat detect_format(int fd) {
+  std::array<unsigned char, 4> magic{};
+  auto n = read_at(fd, magic.data(), magic.size(), 0);
+  if (!n || n.value() != magic.size()) {
+    return CompressedFormat::unknown;
+  }
+  if (magic[0] == 0x1f && magic[1] == 0x8b) {
+    return CompressedFormat::gzip;
+  }
+  if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+      magic[3] == 0xfd) {
+    return CompressedFormat::zstd;
+  }
+  return CompressedFormat::unknown;
+}
+
+bool is_compressed_file(const char* path) {
+  auto fd = ::open(path, O_RDONLY | O_CLOEXEC);  // NOLINT
+  if (fd == -1) {
+    return false;
+  }
+  auto format = detect_format(fd);
+  close(fd);
+  return format != CompressedFormat::unknown;
+}
+
+// Decodes forward from the seek point closest to each read, or keeps going
+// from where the previous read stopped when that is closer.
+class CompressedChunkLoader : public ChunkLoader, NonCopyable {
+public:
+  CompressedChunkLoader(int fd, SeekIndex index)
+      : fd_(fd), index_(std::move(index)) {}
+
+  CompressedChunkLoader(CompressedChunkLoader&&) = delete;
+  CompressedChunkLoader& operator=(CompressedChunkLoader&&) = delete;
+
+  ~CompressedChunkLoader() override {
+    close(fd_);
+  }
+
+  uint64_t size() const final {
+    return index_.size_;
+  }
+
+  Result<std::string> read_chunk(uint64_t offset, uint32_t length) final {
+    std::string data;
+    data.resize(length);
+    TRYV(read_chunk_into(offset, data));
+    return data;
+  }
+
+  Result<void> read_chunk_into(uint64_t offset, std::span<char> out) final {
+    if (offset > index_.size_ || index_.size_ - offset < out.size()) {
+      return make_error(GenericErrc::invalid_argument,
+                        lazy_format("read at {}~{} beyond EOF {}", offset,
+                                    out.size(), index_.size_));
+    }
+
+    std::lock_guard lock(mutex_);
+    auto res = decode_range(offset, out);
+    if (!res) {
+      positioned_ = false;
+    }
+    return res;
+  }
+
+protected:
+  // Reset the decoder to start at `point`.
+  virtual Result<void> restart(const SeekPoint& point) = 0;
+
+  // Decode up to `length` bytes at pos_, 0 means the input ended.
+  virtual Result<uint64_t> decode(char* out, uint64_t length) = 0;
+
+  int fd_;
+  SeekIndex index_;
+
+private:
+  Result<void> decode_range(uint64_t offset, std::span<char> out) {
+    auto length = out.size();
+    auto iter = std::upper_bound(
+        index_.points_.begin(), index_.points_.end(), offset,
+        [](uint64_t off, const SeekPoint& p) { return off < p.out_; });
+    assert(iter != index_.points_.begin());
+    auto& point = *std::prev(iter);
+    if (!positioned_ || offset < pos_ || point.out_ > pos_) {
+      TRYV(restart(point));
+      pos_ = point.out_;
+      positioned_ = true;
+    }
+
+    while (pos_ < offset) {
+      auto n = TRYX(decode(scratch_.data(),
+                           std::min<uint64_t>(scratch_.size(), offset - pos_)));
+      if (n == 0) {
+        return unexpected_eof(offset, length);
+      }
+      pos_ += n;
+    }
+
+    uint64_t done = 0;
+    while (done < length) {
+      auto n = TRYX(decode(out.data() + done, length - done));
+      if (n == 0) {
+        return unexpected_eof(offset, length);
+      }
+      done += n;
+      pos_ += n;
+    }
+    return outcome::success();
+  }
+
+  static Result<void> unexpected_eof(uint64_t offset, uint64_t length) {
+    return make_error(
+        GenericErrc::io_error,
+        lazy_format("unexpected EOF when decompressing {}~{}", offset, length));
+  }
+
+  std::mutex mutex_;
+  bool positioned_ = false;
+  uint64_t pos_ = 0;
+  std::array<char, kInputSize> scratch_{};
+};
+
+// Owns a z_stream for its lifetime.
+struct InflateStream : NonCopyable {
+  InflateStream(InflateStream&&) = delete;
+  InflateStream& operator=(InflateStream&&) = delete;
+  InflateStream() = default;
+
+  ~InflateStream() {
+    if (init) {
+      inflateEnd(&strm);
+    }
+  }
+
+  Result<void> reinit(int window_bits) {
+    if (init) {
+      inflateEnd(&strm);
+      init = false;
+    }
+    strm = z_stream{};
+    if (inflateInit2(&strm, window_bits) != Z_OK) {
+      return GenericErrc::not_enough_memory;
+    }
+    init = true;
+    return outcome::success();
+  }
+
+  z_stream strm{};
+  bool init = false;
+};
+
+static constexpr int kRawDeflate = -15;
+static constexpr int kGzip = 31;
+
+class GzipChunkLoader final : public CompressedChunkLoader {
+public:
+  using CompressedChunkLoader::CompressedChunkLoader;
+
+protected:
+  Result<void> restart(const SeekPoint& point) final {
+    TRYV(z_.reinit(kRawDeflate));
+    raw_ = true;
+    in_pos_ = point.in_ - (point.bits_ != 0 ? 1 : 0);
+    auto& strm = z_.strm;
+    strm.avail_in = 0;
+
+    if (point.bits_ != 0) {
+      TRYV(fill());
+      if (strm.avail_in == 0) {
+        return GenericErrc::io_error;
+      }
+      int ch = *strm.next_in;
+      strm.next_in++;
+      strm.avail_in--;
+      inflatePrime(&strm, point.bits_, ch >> (8 - point.bits_));
+    }
+
+    if (!point.window_.empty()) {
+      std::array<Bytef, kWindowSize> window{};
+      uLongf window_len = window.size();
+      if (uncompress(window.data(), &window_len,
+                     reinterpret_cast<const Bytef*>(  // NOLINT
+                         point.window_.data()),
+                     point.window_.size()) != Z_OK) {
+        return make_error(GenericErrc::bad_message, "corrupt gzip seek point");
+      }
+      inflateSetDictionary(&strm, window.data(), window_len);
+    }
+    return outcome::success();
+  }
+
+  Result<uint64_t> decode(char* out, uint64_t length) final {
+    auto& strm = z_.strm;
+    strm.next_out = reinterpret_cast<Bytef*>(out);  // NOLINT
+    strm.avail_out = static_cast<uInt>(std::min<uint64_t>(length, UINT32_MAX));
+    auto want = strm.avail_out;
+
+    while (strm.avail_out == want) {
+      if (strm.avail_in == 0) {
+        TRYV(fill());
+        if (strm.avail_in == 0) {
+          break;
+        }
+      }
+
+      auto ret = inflate(&strm, Z_NO_FLUSH);
+      if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+        return make_error(GenericErrc::bad_message,
+                          fmt::format("inflate failed: {}",
+                                      strm.msg != nullptr ? strm.msg : "?"));
+      }
+      if (ret != Z_STREAM_END) {
+        continue;
+      }
+
+      // raw inflate leaves the member's trailer to us
+      if (raw_) {
+        TRYV(skip_input(8));
+      }
+      // a concatenated member may follow
+      if (strm.avail_in == 0) {
+        TRYV(fill());
+        if (strm.avail_in == 0) {
+          break;
+        }
+      }
+      inflateReset2(&strm, kGzip);
+      raw_ = false;
+    }
+    return want - strm.avail_out;
+  }
+
+private:
+  Result<void> fill() {
+    auto n = TRYX(read_at(fd_, input_.data(), input_.size(), in_pos_));
+    in_pos_ += n;
+    z_.strm.next_in = input_.data();
+    z_.strm.avail_in = static_cast<uInt>(n);
+    return outcome::success();
+  }
+
+  Result<void> skip_input(uint32_t n) {
+    auto& strm = z_.strm;
+    while (n > 0) {
+      if (strm.avail_in == 0) {
+        TRYV(fill());
+        if (strm.avail_in == 0) {
+          return GenericErrc::io_error;
+        }
+      }
+      auto k = std::min(n, strm.avail_in);
+      strm.next_in += k;
+      strm.avail_in -= k;
+      n -= k;
+    }
+    return outcome::success();
+  }
+
+  InflateStream z_;
+  bool raw_ = true;
+  uint64_t in_pos_ = 0;
+  std::array<Bytef, kInputSize> input_{};
+};
+
+static Result<void> add_gzip_point(SeekIndex& index, const z_stream& strm,
+                                   uint64_t totin, uint64_t totout,
+                                   const std::vector<Bytef>& window) {
+  // the window is circular once more than 32 KiB came out
+  std::string history;
+  if (totout >= kWindowSize) {
+    auto left = strm.avail_out;
+    history.append(reinterpret_cast<const char*>(  // NOLINT
+                       window.data() + kWindowSize - left),
+                   left);
+    history.append(reinterpret_cast<const char*>(window.data()),  // NOLINT
+                   kWindowSize - left);
+  } else {
+    history.append(reinterpret_cast<const char*>(window.data()),  // NOLINT
+                   totout);
+  }
+
+  std::string packed;
+  if (!history.empty()) {
+    uLongf packed_len = compressBound(history.size());
+    packed.resize(packed_len);
+    if (compress(reinterpret_cast<Bytef*>(packed.data()),  // NOLINT
+                 &packed_len,
+                 reinterpret_cast<const Bytef*>(history.data()),  // NOLINT
+                 history.size()) != Z_OK) {
+      return GenericErrc::not_enough_memory;
+    }
+    packed.resize(packed_len);
+  }
+
+  index.points_.push_back(SeekPoint{
+      .out_ = totout,
+      .in_ = totin,
+      .bits_ = static_cast<uint8_t>(strm.data_type & 7),
+      .window_ = std::move(packed),
+  });
+  return outcome::success();
+}
+
+// One full decompression pass recording a seek point at the first deflate
+// block boundary after every `span` bytes of output.
+static Result<void> build_gzip_index(int fd, SeekIndex& index) {
+  InflateStream z;
+  TRYV(z.reinit(kGzip));
+  auto& strm = z.strm;
+
+  std::vector<Bytef> input(kInputSize);
+  std::vector<Bytef> window(kWindowSize);
+  uint64_t file_pos = 0;
+  uint64_t totin = 0;
+  uint64_t totout = 0;
+  uint64_t last = 0;
+  bool eof = false;
+  auto fill = [&]() -> Result<void> {
+    auto n = TRYX(read_at(fd, input.data(), input.size(), file_pos));
+    file_pos += n;
+    eof = n == 0;
+    strm.next_in = input.data();
+    strm.avail_in = static_cast<uInt>(n);
+    return outcome::success();
+  };
+
+  int ret = Z_OK;
+  while (true) {
+    if (strm.avail_in == 0 && !eof) {
+      TRYV(fill());
+    }
+    if (strm.avail_out == 0) {
+      strm.next_out = window.data();
+      strm.avail_out = kWindowSize;
+    }
+
+    totin += strm.avail_in;
+    totout += strm.avail_out;
+    ret = inflate(&strm, Z_BLOCK);
+    totin -= strm.avail_in;
+    totout -= strm.avail_out;
+
+    if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) {
+      return make_error(GenericErrc::bad_message,
+                        fmt::format("inflate failed at {}: {}", totin,
+                                    strm.msg != nullptr ? strm.msg : "?"));
+    }
+    if (ret == Z_BUF_ERROR) {
+      // no progress possible without more input
+      if (eof) {
+        break;
+      }
+      continue;
+    }
+    if (ret == Z_STREAM_END) {
+      // a concatenated member may follow
+      if (strm.avail_in == 0 && !eof) {
+        TRYV(fill());
+      }
+      if (strm.avail_in == 0) {
+        break;
+      }
+      inflateReset2(&strm, kGzip);
+      continue;
+    }
+
+    // at a block boundary that isn't the end of the stream
+    if ((strm.data_type & 128) != 0 && (strm.data_type & 64) == 0 &&
+        (totout == 0 || totout - last > index.span_)) {
+      TRYV(add_gzip_point(index, strm, totin, totout, window));
+      last = totout;
+    }
+  }
+
+  if (ret != Z_STREAM_END) {
+    return make_error(GenericErrc::io_error,
+                      lazy_format("truncated gzip stream at {}", totin));
+  }
+  index.size_ = totout;
+  return outcome::success();
+}
+
+#ifdef ONED_HAVE_ZSTD
+
+// Decodes straight from a read-only mapping of the compressed file.
+class ZstdChunkLoader final : public CompressedChunkLoader {
+public:
+  ZstdChunkLoader(int fd, SeekIndex index, const char* map, uint64_t map_size)
+      : CompressedChunkLoader(fd, std::move(index)),
+        map_(map),
+        map_size_(map_size),
+        dctx_(ZSTD_createDCtx()) {}
+
+  ZstdChunkLoader(ZstdChunkLoader&&) = delete;
+  ZstdChunkLoader& operator=(ZstdChunkLoader&&) = delete;
+
+  ~ZstdChunkLoader() final {
+    ZSTD_freeDCtx(dctx_);
+    munmap(const_cast<char*>(map_), map_size_);  // NOLINT
+  }
+
+protected:
+  Result<void> restart(const SeekPoint& point) final {
+    if (dctx_ == nullptr) {
+      return GenericErrc::not_enough_memory;
+    }
+    ZSTD_DCtx_reset(dctx_, ZSTD_reset_session_only);
+    in_pos_ = point.in_;
+    return outcome::success();
+  }
+
+  Result<uint64_t> decode(char* out, uint64_t length) final {
+    ZSTD_outBuffer o{out, length, 0};
+    // frames run into each other, skippable frames are dropped by zstd
+    while (o.pos == 0 && in_pos_ < map_size_) {
+      ZSTD_inBuffer i{map_ + in_pos_, map_size_ - in_pos_, 0};
+      auto ret = ZSTD_decompressStream(dctx_, &o, &i);
+      in_pos_ += i.pos;
+      if (ZSTD_isError(ret) != 0U) {
+        return make_error(GenericErrc::bad_message,
+                          fmt::format("zstd: {}", ZSTD_getErrorName(ret)));
+      }
+    }
+    return o.pos;
+  }
+
+private:
+  const char* map_;
+  uint64_t map_size_;
+  ZSTD_DCtx* dctx_;
+  uint64_t in_pos_ = 0;
+};
+
+static Result<uint64_t> zstd_frame_size(const char* frame, uint64_t length) {
+  auto size = ZSTD_getFrameContentSize(frame, length);
+  if (size == ZSTD_CONTENTSIZE_ERROR) {
+    return make_error(GenericErrc::bad_message, "invalid zstd frame");
+  }
+  if (size != ZSTD_CONTENTSIZE_UNKNOWN) {
+    return size;
+  }
+
+  // streamed frames don't record their size, decode to count it
+  auto* dctx = ZSTD_createDCtx();
+  if (dctx == nullptr) {
+    return GenericErrc::not_enough_memory;
+  }
+  std::vector<char> scratch(ZSTD_DStreamOutSize());
+  ZSTD_inBuffer in{frame, length, 0};
+  uint64_t total = 0;
+  size_t ret = 1;
+  while (ret != 0 && in.pos < in.size) {
+    ZSTD_outBuffer out{scratch.data(), scratch.size(), 0};
+    ret = ZSTD_decompressStream(dctx, &out, &in);
+    if (ZSTD_isError(ret) != 0U) {
+      ZSTD_freeDCtx(dctx);
+      return make_error(GenericErrc::bad_message,
+                        fmt::format("zstd: {}", ZSTD_getErrorName(ret)));
+    }
+    total += out.pos;
+  }
+  ZSTD_freeDCtx(dctx);
+  return total;
+}
+
+// Every frame start is a seek point, they carry no history.
+static Result<void> build_zstd_index(const char* map, uint64_t map_size,
+                                     SeekIndex& index) {
+  static constexpr uint32_t kSkippableMask = 0xFFFFFFF0;
+  static constexpr uint32_t kSkippableMagic = 0x184D2A50;
+  uint64_t in = 0;
+  uint64_t out = 0;
+  while (in < map_size) {
+    auto csize = ZSTD_findFrameCompressedSize(map + in, map_size - in);
+    if (ZSTD_isError(csize) != 0U) {
+      return make_error(GenericErrc::bad_message,
+                        fmt::format("zstd frame at {}: {}", in,
+                                    ZSTD_getErrorName(csize)));
+    }
+    uint32_t magic = 0;
+    std::memcpy(&magic, map + in, sizeof(magic));
+    magic = boost::endian::little_to_native(magic);
+    if ((magic & kSkippableMask) != kSkippableMagic) {
+      index.points_.push_back(
+          SeekPoint{.out_ = out, .in_ = in, .bits_ = 0, .window_ = {}});
+      out += TRYX(zstd_frame_size(map + in, csize));
+    }
+    in += csize;
+  }
+  if (index.points_.empty()) {
+    index.points_.push_back(
+        SeekPoint{.out_ = 0, .in_ = 0, .bits_ = 0, .window_ = {}});
+  }
+  index.size_ = out;
+  return outcome::success();
+}
+
+#endif
+
+static Result<void> save_index(const char* path, const FileIdentity& identity,
+                               const SeekIndex& index) {
+  // the deflate windows are written straight from the index
+  static constexpr std::size_t kGatherThreshold = 1024;
+  Serializer s({.gather_threshold = kGatherThreshold});
+  s.reserve(buffered_size(index, kGatherThreshold));
+  serialize(s, index);
+  return save_index_section(path, identity, IndexSection::seek_index,
+                            kIndexVersion, s.iovecs());
+}
+
+// A saved index is only used when it was built for this very file.
+static bool load_index(const char* path, const FileIdentity& identity,
+                       SeekIndex& index) {
+  auto file = IndexFile::open(path);
+  if (!file || file.value().identity() != identity) {
+    return false;
+  }
+  auto data = file.value().section(IndexSection::seek_index, kIndexVersion);
+  if (!data) {
+    return false;
+  }
+  Deserializer d{.buffer = data.value()};
+  SeekIndex loaded;
+  deserialize(d, loaded);
+  if (!d.status() || loaded.format_ != index.format_ ||
+      loaded.span_ != index.span_ || loaded.points_.empty()) {
+    return false;
+  }
+  index = std::move(loaded);
+  return true;
+}
+
+Result<ChunkLoaderPtr> open_compressed_loader(
+    const char* path, CompressedLoaderOptions options) {
+  auto fd = ::open(path, O_RDONLY | O_CLOEXEC);  // NOLINT
+  if (fd == -1) {
+    return errno_to_errc(errno);
+  }
+  auto fail = [fd](auto err) {
+    close(fd);
+    return err;
+  };
+
+  auto identity = file_identity(fd);
+  if (!identity) {
+    return fail(std::move(identity).error());
+  }
+  auto format = detect_format(fd);
+
+  SeekIndex index{
+      .format_ = static_cast<uint8_t>(format),
+      .size_ = 0,
+      .span_ = std::max<uint64_t>(options.span, kWindowSize),
+      .points_ = {},
+  };
+  bool loaded = options.index_path != nullptr &&
+                load_index(options.index_path, identity.value(), index);
+
+  if (format == CompressedFormat::gzip) {
+    if (!loaded) {
+      if (auto ret = build_gzip_index(fd, index); !ret) {
+        return fail(std::move(ret).error());
+      }
+      if (index.points_.empty()) {
+        return fail(make_error(GenericErrc::bad_message, "empty gzip stream"));
+      }
+    }
+    if (!loaded && options.index_path != nullptr) {
+      // the loader works without a saved index, it's only slower to reopen
+      (void)save_index(options.index_path, identity.value(), index);
+    }
+    return std::make_unique<GzipChunkLoader>(fd, std::move(index));
+  }
+
+#ifdef ONED_HAVE_ZSTD
+  if (format == CompressedFormat::zstd) {
+    auto size = identity.value().size_;
+    auto* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {  // NOLINT
+      return fail(errno_to_errc(errno));
+    }
+    auto* data = static_cast<const char*>(map);
+    if (!loaded) {
+      if (auto ret = build_zstd_index(data, size, index); !ret) {
+        munmap(map, size);
+        return fail(std::move(ret).error());
+      }
+    }
+    if (!loaded && options.index_path != nullptr) {
+      (void)save_index(options.index_path, identity.value(), index);
+    }
+    madvise(map, size, MADV_RANDOM);
+    return std::make_unique<ZstdChunkLoader>(fd, std::move(index), data, size);
+  }
+#endif
+
+  return fail(GenericErrc::not_supported);
+}
+
+}  // namespace oned
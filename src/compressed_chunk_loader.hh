@@ -0,0 +1,27 @@
+#pragma once
+
+#include "chunk.hh"
+
+namespace oned {
+
+struct CompressedLoaderOptions {
+  // Distance in uncompressed bytes between seek points, reads decompress at
+  // most this much before reaching their offset.
+  uint64_t span = uint64_t(1) << 20;
+  // Where the seek-point index is loaded from, or saved to after a build.
+  // Null keeps the index in memory only.
+  const char* index_path = nullptr;
+};
+
+// Detects gzip and zstd by their magic bytes.
+bool is_compressed_file(const char* path);
+
+// Serves the uncompressed contents of a .gz or .zst file. A gzip stream gets
+// a checkpoint every `span` bytes holding the 32 KiB history inflate needs
+// to resume there. zstd frames are independent, so every frame start is a
+// seek point; files written in small frames (e.g. the seekable format) get
+// cheap random access, a single-frame file is decoded from its start.
+Result<ChunkLoaderPtr> open_compressed_loader(
+    const char* path, CompressedLoaderOptions options = {});
+
+}  // namespace oned
@@ -0,0 +1,140 @@
+#include "chunk_manager.hh"
+#include "compressed_chunk_loader.hh"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <random>
+
+using namespace oned;
+
+class CompressedChunkLoaderTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    // compressible but not trivially so, like a log
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(0, 9999);
+    while (data_.size() < 3 * 1024 * 1024) {
+      data_ += fmt::format("2024-01-01 12:00:{:02} worker-{} request {} ok\n",
+                           data_.size() % 60, dist(rng) % 8, dist(rng));
+    }
+    path_ = ::testing::TempDir() + "compressed_chunk_loader.gz";
+    index_path_ = path_ + ".idx";
+    std::remove(index_path_.c_str());
+  }
+
+  void TearDown() override {
+    std::remove(path_.c_str());
+    std::remove(index_path_.c_str());
+  }
+
+  // gzip's own multi-member layout: each part is a complete gzip stream
+  void write_gzip(int members) {
+    std::remove(path_.c_str());
+    auto part = data_.size() / members;
+    for (int i = 0; i < members; i++) {
+      auto* gz = gzopen(path_.c_str(), i == 0 ? "wb" : "ab");
+      ASSERT_NE(gz, nullptr);
+      auto begin = part * i;
+      auto end = i + 1 == members ? data_.size() : begin + part;
+      ASSERT_EQ(gzwrite(gz, data_.data() + begin, end - begin),
+                static_cast<int>(end - begin));
+      gzclose(gz);
+    }
+  }
+
+  void check_random_reads(ChunkLoader& loader) {
+    ASSERT_EQ(loader.size(), data_.size());
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<uint64_t> offset_dist(0, data_.size() - 1);
+    for (int i = 0; i < 200; i++) {
+      auto offset = offset_dist(rng);
+      auto length = static_cast<uint32_t>(
+          std::min<uint64_t>(rng() % 70000, data_.size() - offset));
+      auto str = loader.read_chunk(offset, length);
+      ASSERT_TRUE(str);
+      ASSERT_EQ(str.value(), std::string_view(data_).substr(offset, length));
+    }
+    // forward and backward neighbours reuse or restart the decoder
+    for (uint64_t offset : {0UL, 100UL, 5000UL, 64UL, data_.size() - 10}) {
+      auto str = loader.read_chunk(offset, 10);
+      ASSERT_TRUE(str);
+      ASSERT_EQ(str.value(), std::string_view(data_).substr(offset, 10));
+    }
+    ASSERT_FALSE(loader.read_chunk(data_.size() - 5, 10));
+  }
+
+  std::string data_;
+  std::string path_;
+  std::string index_path_;
+};
+
+TEST_F(CompressedChunkLoaderTest, gzip_random_access) {
+  write_gzip(1);
+  ASSERT_TRUE(is_compressed_file(path_.c_str()));
+  auto loader = open_compressed_loader(path_.c_str(), {.span = 256 * 1024});
+  ASSERT_TRUE(loader);
+  check_random_reads(*loader.value());
+}
+
+TEST_F(CompressedChunkLoaderTest, gzip_concatenated_members) {
+  write_gzip(3);
+  auto loader = open_compressed_loader(path_.c_str(), {.span = 256 * 1024});
+  ASSERT_TRUE(loader);
+  check_random_reads(*loader.value());
+}
+
+TEST_F(CompressedChunkLoaderTest, saved_index) {
+  write_gzip(2);
+  CompressedLoaderOptions options{
+      .span = 128 * 1024,
+      .index_path = index_path_.c_str(),
+  };
+  {
+    auto loader = open_compressed_loader(path_.c_str(), options);
+    ASSERT_TRUE(loader);
+  }
+  auto* f = std::fopen(index_path_.c_str(), "rb");
+  ASSERT_NE(f, nullptr);
+  std::fclose(f);
+
+  // reopening uses the saved index
+  auto loader = open_compressed_loader(path_.c_str(), options);
+  ASSERT_TRUE(loader);
+  check_random_reads(*loader.value());
+
+  // a different span makes it stale, it is rebuilt
+  options.span = 512 * 1024;
+  loader = open_compressed_loader(path_.c_str(), options);
+  ASSERT_TRUE(loader);
+  check_random_reads(*loader.value());
+}
+
+TEST_F(CompressedChunkLoaderTest, through_chunk_manager) {
+  write_gzip(1);
+  auto loader = ChunkLoader::open(path_.c_str());
+  ASSERT_TRUE(loader);
+  ASSERT_EQ(loader.value()->size(), data_.size());
+
+  ChunkManager mgr(std::move(loader).value(), 65536, 65536 * 4);
+  auto views = calculate_chunk_views(1000000, 300000, 65536);
+  auto handles = mgr.get_chunks(views);
+  ASSERT_TRUE(handles);
+  std::string joined;
+  for (auto& h : handles.value()) {
+    joined.append(h.view());
+  }
+  ASSERT_EQ(joined, data_.substr(1000000, 300000));
+}
+
+TEST_F(CompressedChunkLoaderTest, truncated) {
+  write_gzip(1);
+  auto* f = std::fopen(path_.c_str(), "rb");
+  std::string compressed(1 << 16, '\0');
+  compressed.resize(std::fread(compressed.data(), 1, compressed.size(), f));
+  std::fclose(f);
+  f = std::fopen(path_.c_str(), "wb");
+  std::fwrite(compressed.data(), 1, compressed.size(), f);
+  std::fclose(f);
+  ASSERT_FALSE(open_compressed_loader(path_.c_str()));
+}
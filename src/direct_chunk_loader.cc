@@ -0,0 +1,185 @@
+#include "direct_chunk_loader.hh"
+#include "noncopyable.hh"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace oned {
+
+static constexpr uint64_t kAlign = ChunkBufferPool::kAlignment;
+
+class DirectChunkLoader final : public ChunkLoader, NonCopyable {
+public:
+  DirectChunkLoader(int fd, uint64_t file_size, bool direct)
+      : fd_(fd), file_size_(file_size), direct_(direct) {}
+
+  DirectChunkLoader(DirectChunkLoader&&) = delete;
+  DirectChunkLoader& operator=(DirectChunkLoader&&) = delete;
+
+  ~DirectChunkLoader() final {
+    close(fd_);
+  }
+
+  uint64_t size() const final {
+    return file_size_.load(std::memory_order_acquire);
+  }
+
+  Result<uint64_t> refresh_size() final {
+    struct stat st {};
+    if (fstat(fd_, &st) == -1) {
+      return errno_to_errc(errno);
+    }
+    auto size = static_cast<uint64_t>(st.st_size);
+    if (size > file_size_.load(std::memory_order_relaxed)) {
+      file_size_.store(size, std::memory_order_release);
+    }
+    return file_size_.load(std::memory_order_relaxed);
+  }
+
+  size_t alignment() const final {
+    return kAlign;
+  }
+
+  Result<std::string> read_chunk(uint64_t offset, uint32_t length) final {
+    std::string data;
+    data.resize(length);
+    TRYV(read_chunk_into(offset, data));
+    return data;
+  }
+
+  Result<void> read_chunk_into(uint64_t offset, std::span<char> out) final {
+    auto begin = offset / kAlign * kAlign;
+    auto end = (offset + out.size() + kAlign - 1) / kAlign * kAlign;
+    auto need = offset + out.size() - begin;
+    // pooled chunk buffers of an aligned chunk size take the fast path,
+    // except for a short last chunk
+    if (begin == offset && end - begin == out.size() &&
+        reinterpret_cast<uintptr_t>(out.data()) % kAlign == 0) {  // NOLINT
+      TRYV(read_aligned(out.data(), begin, end - begin, need));
+    } else {
+      auto bounce = TRYX(take_bounce(end - begin));
+      auto r = read_aligned(bounce.data.get(), begin, end - begin, need);
+      if (r) {
+        std::memcpy(out.data(), bounce.data.get() + (offset - begin),
+                    out.size());
+      }
+      give_back(std::move(bounce));
+      TRYV(std::move(r));
+    }
+    if (!direct_) {
+      // only a hint, the data is read either way
+      posix_fadvise(fd_, static_cast<off_t>(begin),
+                    static_cast<off_t>(end - begin), POSIX_FADV_DONTNEED);
+    }
+    return outcome::success();
+  }
+
+private:
+  // Aligned scratch for reads that can't land in `out` directly.
+  struct Bounce {
+    std::unique_ptr<char, decltype(&std::free)> data{nullptr, &std::free};
+    uint64_t size = 0;
+  };
+
+  // Reuse a kept bounce buffer of at least `size` bytes, or allocate one.
+  // Buffers in use are out of bounce_, so reads on several threads don't
+  // wait for each other.
+  Result<Bounce> take_bounce(uint64_t size) {
+    {
+      std::lock_guard lock(bounce_mutex_);
+      if (!bounce_.empty()) {
+        auto b = std::move(bounce_.back());
+        bounce_.pop_back();
+        if (b.size >= size) {
+          return b;
+        }
+      }
+    }
+    Bounce b;
+    b.data.reset(static_cast<char*>(std::aligned_alloc(kAlign, size)));
+    if (b.data == nullptr) {
+      return GenericErrc::not_enough_memory;
+    }
+    b.size = size;
+    return b;
+  }
+
+  void give_back(Bounce&& b) {
+    std::lock_guard lock(bounce_mutex_);
+    if (bounce_.size() < kMaxBounce) {
+      bounce_.push_back(std::move(b));
+    }
+  }
+
+  // Read the aligned range into `buf`, which may run past EOF as long as
+  // the first `need` bytes exist.
+  Result<void> read_aligned(char* buf, uint64_t offset, uint64_t length,
+                            uint64_t need) {
+    uint64_t done = 0;
+    while (done < need) {
+      auto n = pread(fd_, buf + done, length - done,
+                     static_cast<off_t>(offset + done));
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return errno_to_errc(errno);
+      }
+      done += n;
+      // past EOF, or a short read O_DIRECT can't resume from
+      if (n == 0 || (done < need && done % kAlign != 0)) {
+        return make_error(GenericErrc::io_error,
+                          lazy_format("unexpected EOF when reading at {}~{}",
+                                      offset, need));
+      }
+    }
+    return outcome::success();
+  }
+
+  int fd_;
+  std::atomic<uint64_t> file_size_;
+  // false when the filesystem refused O_DIRECT
+  bool direct_;
+
+  // about one per reading thread, e.g. a reader and read-ahead
+  static constexpr std::size_t kMaxBounce = 4;
+  std::mutex bounce_mutex_;
+  std::vector<Bounce> bounce_;
+};
+
+Result<ChunkLoaderPtr> open_direct_loader(const char* path) {
+  bool direct = true;
+  auto fd = ::open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);  // NOLINT
+  if (fd == -1 && errno == EINVAL) {
+    direct = false;
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);  // NOLINT
+  }
+  if (fd == -1) {
+    return errno_to_errc(errno);
+  }
+
+  struct stat st {};
+  if (fstat(fd, &st) == -1) {
+    auto e = errno;
+    close(fd);
+    return errno_to_errc(e);
+  }
+  // a pipe has no page cache to bypass
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    return GenericErrc::not_supported;
+  }
+
+  return std::make_unique<DirectChunkLoader>(
+      fd, static_cast<uint64_t>(st.st_size), direct);
+}
+
+}  // namespace oned
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "chunk.hh"
+
+namespace oned {
+
+// Reads with O_DIRECT, so the bytes are only cached by the ChunkManager and
+// its memory limit bounds what opening a file costs. Reads are widened to
+// ChunkBufferPool::kAlignment, going through a reused bounce buffer unless
+// the target is aligned already. Filesystems without O_DIRECT (e.g. tmpfs) get
+// buffered reads followed by POSIX_FADV_DONTNEED instead.
+Result<ChunkLoaderPtr> open_direct_loader(const char* path);
+
+}  // namespace oned
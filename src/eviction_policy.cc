@@ -0,0 +1,288 @@
+#include "eviction_policy.hh"
+
+#include <boost/intrusive/list.hpp>
+
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+
+namespace oned {
+
+using ChunkList = boost::intrusive::list<Chunk>;
+
+static Chunk *oldest_evictable(ChunkList &list, const Chunk *keep) {
+  for (auto iter = list.rbegin(); iter != list.rend(); ++iter) {
+    if (iter->pins_ == 0 && &*iter != keep) {
+      return &*iter;
+    }
+  }
+  return nullptr;
+}
+
+static void move_to_front(ChunkList &from, ChunkList &to, Chunk &c) {
+  from.erase(from.iterator_to(c));
+  to.push_front(c);
+}
+
+// Ids of recently evicted chunks, newest first.
+class GhostList {
+public:
+  void push(ChunkID id) {
+    order_.push_front(id);
+    index_[id] = order_.begin();
+  }
+
+  bool erase(ChunkID id) {
+    auto iter = index_.find(id);
+    if (iter == index_.end()) {
+      return false;
+    }
+    order_.erase(iter->second);
+    index_.erase(iter);
+    return true;
+  }
+
+  bool contains(ChunkID id) const {
+    return index_.contains(id);
+  }
+
+  void pop_oldest() {
+    index_.erase(order_.back());
+    order_.pop_back();
+  }
+
+  size_t size() const {
+    return order_.size();
+  }
+
+private:
+  std::list<ChunkID> order_;
+  std::unordered_map<ChunkID, std::list<ChunkID>::iterator> index_;
+};
+
+class LruPolicy final : public EvictionPolicy {
+public:
+  ~LruPolicy() final {
+    list_.clear();
+  }
+
+  void insert(Chunk &c) final {
+    list_.push_front(c);
+  }
+
+  void touch(Chunk &c) final {
+    move_to_front(list_, list_, c);
+  }
+
+  void erase(Chunk &c) final {
+    list_.erase(list_.iterator_to(c));
+  }
+
+  Chunk *victim(const Chunk *keep) final {
+    return oldest_evictable(list_, keep);
+  }
+
+  size_t size() const final {
+    return list_.size();
+  }
+
+  void for_each(const std::function<void(const Chunk &)> &f) const final {
+    for (auto &c : list_) {
+      f(c);
+    }
+  }
+
+private:
+  ChunkList list_;
+};
+
+// 2Q of Johnson and Shasha: new chunks enter the A1in FIFO, which gets a
+// quarter of the shard under pressure. Chunks pushed out of A1in are
+// remembered in A1out, a miss on one of them puts it in the Am LRU. Unlike
+// the paper a touch in A1in promotes too, unless nothing was inserted since,
+// that's the same reader coming back at once. The shard is rarely full
+// before a scan starts, so A1in would otherwise hold the hot chunks too.
+class TwoQPolicy final : public EvictionPolicy {
+public:
+  explicit TwoQPolicy(size_t capacity)
+      : in_limit_(std::max<size_t>(capacity / 4, 1)),
+        out_limit_(std::max<size_t>(capacity / 2, 1)) {}
+
+  ~TwoQPolicy() final {
+    in_.clear();
+    main_.clear();
+  }
+
+  void insert(Chunk &c) final {
+    if (out_.erase(c.id_)) {
+      c.queue_ = kMain;
+      main_.push_front(c);
+    } else {
+      c.queue_ = kIn;
+      in_.push_front(c);
+    }
+  }
+
+  void touch(Chunk &c) final {
+    if (c.queue_ == kMain) {
+      move_to_front(main_, main_, c);
+    } else if (&c != &in_.front()) {
+      c.queue_ = kMain;
+      move_to_front(in_, main_, c);
+    }
+  }
+
+  void erase(Chunk &c) final {
+    if (c.queue_ == kMain) {
+      main_.erase(main_.iterator_to(c));
+      return;
+    }
+    in_.erase(in_.iterator_to(c));
+    out_.push(c.id_);
+    if (out_.size() > out_limit_) {
+      out_.pop_oldest();
+    }
+  }
+
+  Chunk *victim(const Chunk *keep) final {
+    Chunk *c = nullptr;
+    if (in_.size() > in_limit_ || main_.empty()) {
+      c = oldest_evictable(in_, keep);
+    }
+    if (c == nullptr) {
+      c = oldest_evictable(main_, keep);
+    }
+    if (c == nullptr) {
+      c = oldest_evictable(in_, keep);
+    }
+    return c;
+  }
+
+  size_t size() const final {
+    return in_.size() + main_.size();
+  }
+
+  void for_each(const std::function<void(const Chunk &)> &f) const final {
+    for (auto &c : main_) {
+      f(c);
+    }
+    for (auto &c : in_) {
+      f(c);
+    }
+  }
+
+private:
+  static constexpr uint8_t kIn = 0;
+  static constexpr uint8_t kMain = 1;
+
+  size_t in_limit_;
+  size_t out_limit_;
+  ChunkList in_;
+  ChunkList main_;
+  GhostList out_;
+};
+
+// ARC of Megiddo and Modha: T1 holds chunks touched once, T2 those touched
+// again. B1 and B2 remember what was evicted from each, a miss on a B1 id
+// means T1 was too small and grows its target share p, a miss on a B2 id
+// shrinks it.
+class ArcPolicy final : public EvictionPolicy {
+public:
+  explicit ArcPolicy(size_t capacity)
+      : capacity_(std::max<size_t>(capacity, 1)) {}
+
+  ~ArcPolicy() final {
+    t1_.clear();
+    t2_.clear();
+  }
+
+  void insert(Chunk &c) final {
+    if (b1_.contains(c.id_)) {
+      p_ = std::min(capacity_,
+                    p_ + std::max<size_t>(b2_.size() / b1_.size(), 1));
+      b1_.erase(c.id_);
+      c.queue_ = kT2;
+      t2_.push_front(c);
+    } else if (b2_.contains(c.id_)) {
+      auto delta = std::max<size_t>(b1_.size() / b2_.size(), 1);
+      p_ = p_ > delta ? p_ - delta : 0;
+      b2_.erase(c.id_);
+      c.queue_ = kT2;
+      t2_.push_front(c);
+    } else {
+      c.queue_ = kT1;
+      t1_.push_front(c);
+    }
+  }
+
+  void touch(Chunk &c) final {
+    move_to_front(c.queue_ == kT1 ? t1_ : t2_, t2_, c);
+    c.queue_ = kT2;
+  }
+
+  void erase(Chunk &c) final {
+    if (c.queue_ == kT1) {
+      t1_.erase(t1_.iterator_to(c));
+      b1_.push(c.id_);
+    } else {
+      t2_.erase(t2_.iterator_to(c));
+      b2_.push(c.id_);
+    }
+    while (b1_.size() != 0 && t1_.size() + b1_.size() > capacity_) {
+      b1_.pop_oldest();
+    }
+    while (b2_.size() != 0 &&
+           t1_.size() + t2_.size() + b1_.size() + b2_.size() > 2 * capacity_) {
+      b2_.pop_oldest();
+    }
+  }
+
+  Chunk *victim(const Chunk *keep) final {
+    bool from_t1 = !t1_.empty() && (t1_.size() > p_ || t2_.empty());
+    auto *c = oldest_evictable(from_t1 ? t1_ : t2_, keep);
+    if (c == nullptr) {
+      c = oldest_evictable(from_t1 ? t2_ : t1_, keep);
+    }
+    return c;
+  }
+
+  size_t size() const final {
+    return t1_.size() + t2_.size();
+  }
+
+  void for_each(const std::function<void(const Chunk &)> &f) const final {
+    for (auto &c : t2_) {
+      f(c);
+    }
+    for (auto &c : t1_) {
+      f(c);
+    }
+  }
+
+private:
+  static constexpr uint8_t kT1 = 0;
+  static constexpr uint8_t kT2 = 1;
+
+  size_t capacity_;
+  // target size of T1
+  size_t p_ = 0;
+  ChunkList t1_;
+  ChunkList t2_;
+  GhostList b1_;
+  GhostList b2_;
+};
+
+std::unique_ptr<EvictionPolicy> EvictionPolicy::make(EvictionKind kind,
+                                                     size_t capacity) {
+  switch (kind) {
+    case EvictionKind::two_q:
+      return std::make_unique<TwoQPolicy>(capacity);
+    case EvictionKind::arc:
+      return std::make_unique<ArcPolicy>(capacity);
+    case EvictionKind::lru:
+      break;
+  }
+  return std::make_unique<LruPolicy>();
+}
+
+}  // namespace oned
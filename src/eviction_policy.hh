@@ -0,0 +1,48 @@
+#pragma once
+
+#include "chunk.hh"
+
+#include <functional>
+#include <memory>
+
+namespace oned {
+
+enum class EvictionKind : uint8_t {
+  lru,
+  // 2Q: first touches wait in a FIFO, only chunks touched again get into
+  // the main LRU, so a one-off scan passes through
+  two_q,
+  // ARC: balances a recency and a frequency list, adapting the split to
+  // hits on recently evicted chunks
+  arc,
+};
+
+// Orders the resident chunks of one shard for eviction. Policies link the
+// chunks into their own lists through the Chunk hook and may remember ids
+// of evicted chunks. Calls happen with the shard lock held.
+class EvictionPolicy {  // NOLINT
+public:
+  virtual ~EvictionPolicy() = default;
+
+  // `c` became resident.
+  virtual void insert(Chunk &c) = 0;
+  // A resident chunk was touched again.
+  virtual void touch(Chunk &c) = 0;
+  // `c` is being evicted, it was returned by victim().
+  virtual void erase(Chunk &c) = 0;
+  // The chunk to evict next, never a pinned one or `keep`. Null when every
+  // resident chunk is protected.
+  virtual Chunk *victim(const Chunk *keep) = 0;
+
+  virtual size_t size() const = 0;
+
+  // Resident chunks, the ones kept longest first.
+  virtual void for_each(const std::function<void(const Chunk &)> &f) const = 0;
+
+  // `capacity` is the number of chunks the shard holds, policies that
+  // remember evicted ids size their history after it.
+  static std::unique_ptr<EvictionPolicy> make(EvictionKind kind,
+                                              size_t capacity);
+};
+
+}  // namespace oned
@@ -0,0 +1,96 @@
+#include "eviction_policy.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <random>
+
+using namespace oned;
+
+static constexpr size_t kCapacity = 256;
+static constexpr ChunkID kFileChunks = 4096;
+
+// A viewer scrolling around a few spots of a large file, with a search
+// running over the whole file every now and then.
+static std::vector<ChunkID> synthetic_trace() {
+  std::mt19937 rng(42);
+  std::vector<ChunkID> trace;
+  ChunkID spots[4] = {100, 900, 2000, 3500};
+  for (int round = 0; round < 32; round++) {
+    for (int i = 0; i < 2000; i++) {
+      auto spot = spots[rng() % 4];
+      // the viewport covers a few chunks, scrolling stays near the spot
+      auto pos = spot + std::geometric_distribution<ChunkID>(0.1)(rng) % 32;
+      for (ChunkID id = pos; id < pos + 4; id++) {
+        trace.push_back(id % kFileChunks);
+      }
+    }
+    for (ChunkID id = 0; id < kFileChunks; id++) {
+      trace.push_back(id);
+    }
+  }
+  return trace;
+}
+
+// ONED_EVICTION_TRACE names a file of whitespace separated chunk ids to
+// replay instead, e.g. recorded from a real session.
+static const std::vector<ChunkID> &trace() {
+  static const auto ret = [] {
+    const char *path = std::getenv("ONED_EVICTION_TRACE");
+    if (path == nullptr) {
+      return synthetic_trace();
+    }
+    std::vector<ChunkID> ids;
+    std::ifstream in(path);
+    for (ChunkID id = 0; in >> id;) {
+      ids.push_back(id);
+    }
+    return ids;
+  }();
+  return ret;
+}
+
+// Replays the trace against a cache of kCapacity chunks, reports the share
+// of touches served without loading.
+static void replay(benchmark::State &state, EvictionKind kind) {
+  uint64_t hits = 0;
+  uint64_t touches = 0;
+  for (auto _ : state) {
+    std::deque<Chunk> chunks;
+    auto policy = EvictionPolicy::make(kind, kCapacity);
+    for (auto id : trace()) {
+      while (chunks.size() <= id) {
+        auto next = static_cast<ChunkID>(chunks.size());
+        chunks.emplace_back().id_ = next;
+      }
+      auto &c = chunks[id];
+      touches++;
+      if (c.is_linked()) {
+        policy->touch(c);
+        hits++;
+        continue;
+      }
+      policy->insert(c);
+      if (policy->size() > kCapacity) {
+        policy->erase(*policy->victim(&c));
+      }
+    }
+  }
+  state.counters["hit_ratio"] = double(hits) / double(touches);
+  state.counters["touches"] = benchmark::Counter(
+      double(touches), benchmark::Counter::kIsRate);
+}
+
+static const bool registered = [] {
+  for (auto [name, kind] : {std::pair{"lru", EvictionKind::lru},
+                            {"two_q", EvictionKind::two_q},
+                            {"arc", EvictionKind::arc}}) {
+    benchmark::RegisterBenchmark(
+        fmt::format("BM_EvictionReplay/{}", name).c_str(), replay, kind)
+        ->Unit(benchmark::kMillisecond);
+  }
+  return true;
+}();
@@ -0,0 +1,178 @@
+#include "chunk_manager.hh"
+#include "eviction_policy.hh"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <deque>
+
+using namespace oned;
+
+// Replays chunk touches against a policy holding at most `capacity` chunks.
+class Cache {
+public:
+  Cache(EvictionKind kind, size_t capacity)
+      : policy_(EvictionPolicy::make(kind, capacity)), capacity_(capacity) {}
+
+  Chunk& chunk(ChunkID id) {
+    while (chunks_.size() <= id) {
+      auto next = static_cast<ChunkID>(chunks_.size());
+      chunks_.emplace_back().id_ = next;
+    }
+    return chunks_[id];
+  }
+
+  // whether `id` was resident
+  bool touch(ChunkID id) {
+    auto& c = chunk(id);
+    if (c.is_linked()) {
+      policy_->touch(c);
+      return true;
+    }
+    policy_->insert(c);
+    while (policy_->size() > capacity_) {
+      auto* victim = policy_->victim(&c);
+      if (victim == nullptr) {
+        break;
+      }
+      policy_->erase(*victim);
+    }
+    return false;
+  }
+
+  size_t touch_range(ChunkID first, ChunkID count) {
+    size_t hits = 0;
+    for (ChunkID id = first; id < first + count; id++) {
+      hits += touch(id) ? 1 : 0;
+    }
+    return hits;
+  }
+
+  EvictionPolicy& policy() {
+    return *policy_;
+  }
+
+private:
+  std::deque<Chunk> chunks_;
+  std::unique_ptr<EvictionPolicy> policy_;
+  size_t capacity_;
+};
+
+// A hot set revisited in between scans of twice the cache size.
+static size_t hot_hits_after_scans(EvictionKind kind) {
+  constexpr ChunkID kCapacity = 64;
+  constexpr ChunkID kHot = 8;
+  Cache cache(kind, kCapacity);
+  cache.touch_range(0, kHot);
+  cache.touch_range(0, kHot);
+  cache.touch_range(1000, kCapacity);
+  cache.touch_range(0, kHot);
+  cache.touch_range(2000, 2 * kCapacity);
+  return cache.touch_range(0, kHot);
+}
+
+TEST(EvictionPolicyTest, lru_loses_hot_set_to_scan) {
+  ASSERT_EQ(hot_hits_after_scans(EvictionKind::lru), 0);
+}
+
+TEST(EvictionPolicyTest, two_q_keeps_hot_set) {
+  ASSERT_EQ(hot_hits_after_scans(EvictionKind::two_q), 8);
+}
+
+TEST(EvictionPolicyTest, arc_keeps_hot_set) {
+  ASSERT_EQ(hot_hits_after_scans(EvictionKind::arc), 8);
+}
+
+TEST(EvictionPolicyTest, skips_pinned) {
+  for (auto kind :
+       {EvictionKind::lru, EvictionKind::two_q, EvictionKind::arc}) {
+    Cache cache(kind, 2);
+    cache.touch(0);
+    cache.chunk(0).pins_++;
+    cache.touch(1);
+    cache.touch(2);
+    ASSERT_TRUE(cache.chunk(0).is_linked());
+    ASSERT_FALSE(cache.chunk(1).is_linked());
+
+    // nothing but pinned chunks and the one to keep
+    cache.chunk(2).pins_++;
+    ASSERT_EQ(cache.policy().victim(nullptr), nullptr);
+    cache.chunk(0).pins_--;
+    ASSERT_EQ(cache.policy().victim(&cache.chunk(0)), nullptr);
+    ASSERT_EQ(cache.policy().victim(nullptr), &cache.chunk(0));
+    cache.chunk(2).pins_--;
+  }
+}
+
+TEST(EvictionPolicyTest, for_each_visits_resident) {
+  for (auto kind :
+       {EvictionKind::lru, EvictionKind::two_q, EvictionKind::arc}) {
+    Cache cache(kind, 4);
+    cache.touch_range(0, 10);
+    std::vector<ChunkID> ids;
+    cache.policy().for_each([&](const Chunk& c) { ids.push_back(c.id_); });
+    std::sort(ids.begin(), ids.end());
+    ASSERT_EQ(ids, (std::vector<ChunkID>{6, 7, 8, 9}));
+  }
+}
+
+class StringLoader final : public ChunkLoader, NonCopyable {
+public:
+  explicit StringLoader(std::string data) : data_(std::move(data)) {}
+
+  uint64_t size() const final {
+    return data_.size();
+  }
+
+  Result<std::string> read_chunk(uint64_t offset, uint32_t length) final {
+    return data_.substr(offset, length);
+  }
+
+private:
+  std::string data_;
+};
+
+TEST(EvictionPolicyTest, chunk_manager) {
+  std::string data;
+  for (int i = 0; i < 100; i++) {
+    data += std::string(10, char('a' + i % 26));
+  }
+  for (auto kind : {EvictionKind::two_q, EvictionKind::arc}) {
+    ChunkManager mgr(std::make_unique<StringLoader>(data), 10, 80,
+                     ChunkManagerOptions{.shard_count = 2, .eviction = kind});
+    uint64_t misses = 0;
+    for (int pass = 0; pass < 3; pass++) {
+      for (ChunkID id = 0; id < 100; id++) {
+        // the first chunks of each shard are revisited all the time
+        for (ChunkID hot = 0; hot < 4; hot++) {
+          auto ret = mgr.read(ChunkView{hot, 0, 10});
+          ASSERT_TRUE(ret);
+          ASSERT_EQ(ret.value(), data.substr(hot * 10, 10));
+        }
+        auto ret = mgr.read(ChunkView{id, 0, 10});
+        ASSERT_TRUE(ret);
+        ASSERT_EQ(ret.value(), data.substr(id * 10, 10));
+        ASSERT_LE(mgr.chunk_count(), 8);
+      }
+      // once warm only the scan misses, the hot chunks stay resident
+      if (pass == 0) {
+        misses = mgr.prefetch_stats().misses;
+      } else {
+        ASSERT_EQ(mgr.prefetch_stats().misses, misses + 96);
+        misses += 96;
+      }
+    }
+
+    // a batched scan touches its chunks once, it doesn't promote them.
+    // Batches of one chunk per shard, pinned chunks can't be evicted.
+    for (ChunkID id = 4; id < 100; id += 2) {
+      auto handles = mgr.get_chunks(calculate_chunk_views(id * 10, 20, 10));
+      ASSERT_TRUE(handles);
+    }
+    misses = mgr.prefetch_stats().misses;
+    for (ChunkID hot = 0; hot < 4; hot++) {
+      ASSERT_TRUE(mgr.read(ChunkView{hot, 0, 10}));
+    }
+    ASSERT_EQ(mgr.prefetch_stats().misses, misses);
+  }
+}
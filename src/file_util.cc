@@ -0,0 +1,174 @@
+#include "file_util.hh"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <array>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+
+namespace oned {
+
+static Result<uint32_t> hash_range(int fd, uint64_t offset, uint64_t length) {
+  std::array<char, kIdentityHashBytes> buf{};
+  uint64_t done = 0;
+  while (done < length) {
+    auto n = ::pread(fd, buf.data() + done, length - done,
+                     static_cast<off_t>(offset + done));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      return errno_to_errc(errno);
+    }
+    if (n == 0) {
+      break;
+    }
+    done += static_cast<uint64_t>(n);
+  }
+  return static_cast<uint32_t>(crc32_z(
+      0, reinterpret_cast<const Bytef*>(buf.data()), done));  // NOLINT
+}
+
+static FileIdentity stat_identity(const struct stat& st) {
+  return FileIdentity{
+      .size_ = static_cast<uint64_t>(st.st_size),
+      .mtime_ns_ =
+          int64_t(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec,
+  };
+}
+
+Result<FileIdentity> file_identity(int fd) {
+  struct stat st {};
+  if (::fstat(fd, &st) == -1) {
+    return errno_to_errc(errno);
+  }
+  auto identity = stat_identity(st);
+  // pipes have nothing to read back
+  if (S_ISREG(st.st_mode)) {
+    auto length = std::min(identity.size_, kIdentityHashBytes);
+    identity.head_hash_ = TRYX(hash_range(fd, 0, length));
+    identity.tail_hash_ =
+        TRYX(hash_range(fd, identity.size_ - length, length));
+  }
+  return identity;
+}
+
+Result<FileIdentity> file_identity(const char* path) {
+  struct stat st {};
+  if (::stat(path, &st) == -1) {
+    return errno_to_errc(errno);
+  }
+  // opening a fifo would wait for a writer
+  if (!S_ISREG(st.st_mode)) {
+    return stat_identity(st);
+  }
+  auto fd = ::open(path, O_RDONLY | O_CLOEXEC);  // NOLINT
+  if (fd == -1) {
+    return errno_to_errc(errno);
+  }
+  auto ret = file_identity(fd);
+  ::close(fd);
+  return ret;
+}
+
+Result<bool> appended_to(const char* path, const FileIdentity& before) {
+  struct stat st {};
+  if (::stat(path, &st) == -1) {
+    return errno_to_errc(errno);
+  }
+  if (!S_ISREG(st.st_mode) ||
+      static_cast<uint64_t>(st.st_size) < before.size_) {
+    return false;
+  }
+  auto fd = ::open(path, O_RDONLY | O_CLOEXEC);  // NOLINT
+  if (fd == -1) {
+    return errno_to_errc(errno);
+  }
+  // hash the ranges file_identity hashed back when the file had that size
+  auto length = std::min(before.size_, kIdentityHashBytes);
+  auto head = hash_range(fd, 0, length);
+  auto tail = hash_range(fd, before.size_ - length, length);
+  ::close(fd);
+  if (!head || !tail) {
+    return GenericErrc::io_error;
+  }
+  return head.value() == before.head_hash_ &&
+         tail.value() == before.tail_hash_;
+}
+
+Result<std::string> read_whole_file(const char* path) {
+  auto* f = std::fopen(path, "rb");  // NOLINT
+  if (f == nullptr) {
+    return errno_to_errc(errno);
+  }
+  std::string data;
+  std::array<char, 65536> buf{};
+  while (auto n = std::fread(buf.data(), 1, buf.size(), f)) {
+    data.append(buf.data(), n);
+  }
+  auto failed = std::ferror(f) != 0;
+  std::fclose(f);  // NOLINT
+  if (failed) {
+    return GenericErrc::io_error;
+  }
+  return data;
+}
+
+Result<void> write_file_atomic(const char* path, std::string_view data) {
+  return write_file_atomic(
+      path, {iovec{const_cast<char*>(data.data()), data.size()}});  // NOLINT
+}
+
+static Result<void> writev_all(int fd, std::vector<iovec> pieces) {
+  auto* iov = pieces.data();
+  auto* end = iov + pieces.size();
+  while (iov != end) {
+    auto n = ::writev(fd, iov, static_cast<int>(std::min<ptrdiff_t>(
+                                   end - iov, IOV_MAX)));
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno_to_errc(errno);
+    }
+    // skip what was written, a short write may stop inside a piece
+    for (auto done = static_cast<size_t>(n); iov != end;) {
+      if (done < iov->iov_len) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+        iov->iov_len -= done;
+        break;
+      }
+      done -= iov->iov_len;
+      iov++;
+    }
+  }
+  return outcome::success();
+}
+
+Result<void> write_file_atomic(const char* path,
+                               const std::vector<iovec>& pieces) {
+  auto tmp = fmt::format("{}.tmp", path);
+  auto fd = ::open(tmp.c_str(),  // NOLINT
+                   O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    return errno_to_errc(errno);
+  }
+  auto ret = writev_all(fd, pieces);
+  if (::close(fd) != 0 && ret) {
+    ret = errno_to_errc(errno);
+  }
+  if (ret && std::rename(tmp.c_str(), path) != 0) {
+    ret = errno_to_errc(errno);
+  }
+  if (!ret) {
+    std::remove(tmp.c_str());
+  }
+  return ret;
+}
+
+}  // namespace oned
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "outcome.hh"
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace oned {
+
+// What a saved index records about the file it was built from.
+struct FileIdentity {
+  uint64_t size_ = 0;
+  int64_t mtime_ns_ = 0;
+  // crc32 of the first and last kIdentityHashBytes of a regular file, catch
+  // rewrites that keep size and mtime
+  uint32_t head_hash_ = 0;
+  uint32_t tail_hash_ = 0;
+
+  bool operator==(const FileIdentity&) const = default;
+};
+
+inline constexpr uint64_t kIdentityHashBytes = 4096;
+
+Result<FileIdentity> file_identity(const char* path);
+
+Result<FileIdentity> file_identity(int fd);
+
+// Whether the regular file at `path` is the one `before` was taken of with
+// data appended since, judged by the bytes `before` hashed.
+Result<bool> appended_to(const char* path, const FileIdentity& before);
+
+Result<std::string> read_whole_file(const char* path);
+
+// Write to `path`.tmp and rename, so readers never see a partial file.
+Result<void> write_file_atomic(const char* path, std::string_view data);
+
+// The same with the pieces gathered by writev, e.g. Serializer::iovecs().
+Result<void> write_file_atomic(const char* path,
+                               const std::vector<iovec>& pieces);
+
+}  // namespace oned
@@ -0,0 +1,82 @@
+#include "follow.hh"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+
+namespace oned {
+
+Result<std::unique_ptr<Follower>> Follower::start(ChunkManager &mgr,
+                                                  const char *path,
+                                                  GrowCallback on_grow,
+                                                  FollowOptions options) {
+  auto stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (stop_fd == -1) {
+    return errno_to_errc(errno);
+  }
+  auto inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (inotify_fd != -1 &&
+      inotify_add_watch(inotify_fd, path, IN_MODIFY | IN_CLOSE_WRITE) == -1) {
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  return std::unique_ptr<Follower>(new Follower(
+      mgr, inotify_fd, stop_fd, std::move(on_grow), options));
+}
+
+Follower::Follower(ChunkManager &mgr, int inotify_fd, int stop_fd,
+                   GrowCallback on_grow, FollowOptions options)
+    : mgr_(mgr),
+      inotify_fd_(inotify_fd),
+      stop_fd_(stop_fd),
+      on_grow_(std::move(on_grow)),
+      options_(options),
+      thread_([this] { run(); }) {}
+
+Follower::~Follower() {
+  uint64_t one = 1;
+  (void)write(stop_fd_, &one, sizeof(one));
+  thread_.join();
+  if (inotify_fd_ != -1) {
+    close(inotify_fd_);
+  }
+  close(stop_fd_);
+}
+
+void Follower::run() {
+  std::array<pollfd, 2> fds{
+      pollfd{.fd = stop_fd_, .events = POLLIN, .revents = 0},
+      pollfd{.fd = inotify_fd_, .events = POLLIN, .revents = 0},
+  };
+  auto nfds = inotify_fd_ == -1 ? 1 : 2;
+  // inotify_event carries a name, room for a batch of them
+  alignas(inotify_event) std::array<char, 4096> events{};
+  while (true) {
+    auto n = poll(fds.data(), nfds, static_cast<int>(
+                                        options_.poll_interval.count()));
+    if (n == -1 && errno != EINTR) {
+      return;
+    }
+    if ((fds[0].revents & POLLIN) != 0) {
+      return;
+    }
+    if (nfds == 2 && (fds[1].revents & POLLIN) != 0) {
+      // a burst of writes needs one refresh only
+      while (read(inotify_fd_, events.data(), events.size()) > 0) {
+      }
+    }
+
+    auto old_size = mgr_.size();
+    // transient errors are retried on the next event or tick
+    auto size = mgr_.refresh();
+    if (size && size.value() > old_size && on_grow_) {
+      on_grow_(old_size, size.value());
+    }
+  }
+}
+
+}  // namespace oned
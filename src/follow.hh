@@ -0,0 +1,55 @@
+#pragma once
+
+#include "chunk_manager.hh"
+#include "noncopyable.hh"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+
+namespace oned {
+
+struct FollowOptions {
+  // Refresh at least this often, catches writers inotify can't see (e.g.
+  // on NFS) and bounds the lag when an event is missed.
+  std::chrono::milliseconds poll_interval{50};
+};
+
+// Tails a growing file: a background thread waits for inotify to report
+// writes, refreshes the ChunkManager and tells `on_grow` about the new
+// size. Lines appended to a LineIndex can be picked up from the callback
+// with LineIndex::extend. With a pread-based loader truncation is
+// ignored, the manager keeps the size it has seen and reads past the new
+// end fail. A mapped loader can't touch the lost pages, the refresh and
+// every read after it fail.
+class Follower : NonCopyable {
+public:
+  using GrowCallback = std::function<void(uint64_t old_size, uint64_t size)>;
+
+  // `mgr` must outlive the follower.
+  static Result<std::unique_ptr<Follower>> start(ChunkManager &mgr,
+                                                 const char *path,
+                                                 GrowCallback on_grow,
+                                                 FollowOptions options = {});
+
+  Follower(Follower &&) = delete;
+  Follower &operator=(Follower &&) = delete;
+  ~Follower();
+
+private:
+  Follower(ChunkManager &mgr, int inotify_fd, int stop_fd,
+           GrowCallback on_grow, FollowOptions options);
+
+  void run();
+
+  ChunkManager &mgr_;
+  // -1 when inotify is unavailable, polling alone keeps up then
+  int inotify_fd_;
+  int stop_fd_;
+  GrowCallback on_grow_;
+  FollowOptions options_;
+  std::thread thread_;
+};
+
+}  // namespace oned
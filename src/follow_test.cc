@@ -0,0 +1,176 @@
+#include "follow.hh"
+#include "line_index.hh"
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <mutex>
+
+using namespace oned;
+using namespace std::chrono_literals;
+
+class FollowTest : public ::testing::TestWithParam<ChunkLoaderKind> {
+protected:
+  void SetUp() override {
+    path_ = ::testing::TempDir() + "follow";
+    file_ = std::fopen(path_.c_str(), "wb");
+    ASSERT_NE(file_, nullptr);
+  }
+
+  void TearDown() override {
+    mgr_.reset();
+    std::fclose(file_);
+    std::remove(path_.c_str());
+  }
+
+  void append(const std::string& data) {
+    data_ += data;
+    ASSERT_EQ(std::fwrite(data.data(), 1, data.size(), file_), data.size());
+    std::fflush(file_);
+  }
+
+  void open_manager(uint32_t chunk_size) {
+    auto loader = ChunkLoader::open(path_.c_str(), {.kind = GetParam()});
+    ASSERT_TRUE(loader);
+    mgr_ = std::make_unique<ChunkManager>(std::move(loader).value(),
+                                          chunk_size, chunk_size * 8,
+                                          ChunkManagerOptions{.shard_count = 2});
+  }
+
+  std::string path_;
+  std::FILE* file_ = nullptr;
+  std::string data_;
+  std::unique_ptr<ChunkManager> mgr_;
+};
+
+TEST_P(FollowTest, RefreshGrowsPartialChunk) {
+  append("0123456789");
+  open_manager(16);
+  ASSERT_EQ(mgr_->size(), 10);
+
+  auto pinned = mgr_->get_chunk(ChunkView{.id_ = 0, .offset_ = 0, .length_ = 10});
+  ASSERT_TRUE(pinned);
+  EXPECT_EQ(pinned.value().view(), "0123456789");
+
+  // nothing new yet
+  ASSERT_TRUE(mgr_->refresh());
+  EXPECT_EQ(mgr_->size(), 10);
+
+  append("abcdefghijklmnopqrstuvwxyz");
+  auto size = mgr_->refresh();
+  ASSERT_TRUE(size);
+  EXPECT_EQ(size.value(), data_.size());
+  EXPECT_EQ(mgr_->size(), data_.size());
+
+  // the view handed out before the refresh is untouched
+  EXPECT_EQ(pinned.value().view(), "0123456789");
+  for (auto view : calculate_chunk_views(0, data_.size(), 16)) {
+    auto str = mgr_->read(view);
+    ASSERT_TRUE(str);
+    EXPECT_EQ(str.value(), data_.substr(view.id_ * 16 + view.offset_,
+                                        view.length_));
+  }
+}
+
+TEST_P(FollowTest, TailWithLineIndex) {
+  append("first line\n");
+  open_manager(4096);
+  auto index = LineIndex::open(*mgr_, path_.c_str(), {.stride = 64});
+  ASSERT_TRUE(index);
+
+  std::mutex mutex;
+  std::atomic<uint64_t> seen{0};
+  FollowOptions options{.poll_interval = 50ms};
+  auto follower = Follower::start(
+      *mgr_, path_.c_str(),
+      [&](uint64_t, uint64_t size) {
+        std::lock_guard lock(mutex);
+        ASSERT_TRUE(index.value().extend());
+        seen.store(size);
+      },
+      options);
+  ASSERT_TRUE(follower);
+
+  // about 100 MB/s in 1 MiB writes
+  std::string block;
+  for (int i = 0; block.size() < (1 << 20); i++) {
+    block += fmt::format("line {} of a fast writer\n", i);
+  }
+  auto deadline = std::chrono::steady_clock::now() + 300ms;
+  while (std::chrono::steady_clock::now() < deadline) {
+    append(block);
+    std::this_thread::sleep_for(10ms);
+  }
+  append("no newline yet");
+
+  // the last write shows up within a few poll intervals, a few more small
+  // writes are measured if a loaded machine delays the first
+  auto bound = 4 * options.poll_interval;
+  auto lag = std::chrono::steady_clock::duration::max();
+  for (int attempt = 0; attempt < 5 && lag >= bound; attempt++) {
+    if (attempt > 0) {
+      append(".");
+    }
+    auto written = std::chrono::steady_clock::now();
+    while (seen.load() != data_.size() &&
+           std::chrono::steady_clock::now() - written < 5s) {
+      std::this_thread::sleep_for(1ms);
+    }
+    ASSERT_EQ(seen.load(), data_.size());
+    lag = std::min(lag, std::chrono::steady_clock::now() - written);
+  }
+  EXPECT_LT(lag, bound);
+  follower.value().reset();
+
+  std::lock_guard lock(mutex);
+  auto& lines = index.value();
+  uint64_t expected = std::count(data_.begin(), data_.end(), '\n') + 1;
+  ASSERT_EQ(lines.line_count(), expected);
+  auto last = lines.line_to_offset(expected - 1);
+  ASSERT_TRUE(last);
+  EXPECT_EQ(last.value(), data_.rfind('\n') + 1);
+  EXPECT_TRUE(data_.substr(last.value()).starts_with("no newline yet"));
+  auto line = lines.offset_to_line(data_.size() - 1);
+  ASSERT_TRUE(line);
+  EXPECT_EQ(line.value(), expected - 1);
+}
+
+TEST_P(FollowTest, Truncation) {
+  append(std::string(64, 'x'));
+  open_manager(16);
+  ASSERT_TRUE(mgr_->read(ChunkView{.id_ = 0, .offset_ = 0, .length_ = 16}));
+
+  // copytruncate-style rotation
+  ASSERT_EQ(::ftruncate(fileno(file_), 0), 0);
+  auto size = mgr_->refresh();
+  auto cached = mgr_->read(ChunkView{.id_ = 0, .offset_ = 0, .length_ = 16});
+  auto lost = mgr_->read(ChunkView{.id_ = 3, .offset_ = 0, .length_ = 16});
+  if (GetParam() == ChunkLoaderKind::mmap) {
+    // fails instead of faulting on the lost pages
+    EXPECT_FALSE(size);
+    EXPECT_FALSE(cached);
+  } else {
+    ASSERT_TRUE(size);
+    EXPECT_EQ(size.value(), 64);
+    ASSERT_TRUE(cached);
+    EXPECT_EQ(cached.value(), std::string(16, 'x'));
+  }
+  EXPECT_FALSE(lost);
+}
+
+INSTANTIATE_TEST_SUITE_P(Loaders, FollowTest,
+                         ::testing::Values(ChunkLoaderKind::stdio,
+                                           ChunkLoaderKind::mmap,
+                                           ChunkLoaderKind::io_uring),
+                         [](const auto& info) {
+                           switch (info.param) {
+                             case ChunkLoaderKind::stdio:
+                               return "stdio";
+                             case ChunkLoaderKind::mmap:
+                               return "mmap";
+                             default:
+                               return "io_uring";
+                           }
+                         });
@@ -0,0 +1,225 @@
+#include "index_file.hh"
+#include "serde.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+namespace oned {
+
+static constexpr std::string_view kMagic{"ONEDIDX\0", 8};
+static constexpr uint32_t kFormatVersion = 1;
+static constexpr uint64_t kAlignment = 8;
+// magic, header length and crc
+static constexpr uint64_t kPreambleSize = kMagic.size() + 8;
+
+struct IndexHeader {
+  uint32_t version_;
+  FileIdentity identity_;
+  std::vector<IndexFile::Entry> sections_;
+};
+
+static uint64_t align_up(uint64_t n) {
+  return (n + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+static uint32_t crc(std::string_view data, uint32_t crc = 0) {
+  return static_cast<uint32_t>(crc32_z(
+      crc, reinterpret_cast<const Bytef*>(data.data()),  // NOLINT
+      data.size()));
+}
+
+static uint32_t load_u32(const char* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return boost::endian::little_to_native(v);
+}
+
+static void store_u32(char* p, uint32_t v) {
+  v = boost::endian::native_to_little(v);
+  std::memcpy(p, &v, sizeof(v));
+}
+
+Result<IndexFile> IndexFile::open(const char* path) {
+  auto fd = ::open(path, O_RDONLY | O_CLOEXEC);  // NOLINT
+  if (fd == -1) {
+    return errno_to_errc(errno);
+  }
+  struct stat st {};
+  if (fstat(fd, &st) == -1) {
+    auto e = errno;
+    close(fd);
+    return errno_to_errc(e);
+  }
+  auto size = static_cast<uint64_t>(st.st_size);
+  if (size < kPreambleSize) {
+    close(fd);
+    return make_error(GenericErrc::bad_message,
+                      fmt::format("{}: not an index file", path));
+  }
+  auto* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  auto e = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {  // NOLINT
+    return errno_to_errc(e);
+  }
+
+  IndexFile file(addr, size);
+  std::string_view data(static_cast<const char*>(addr), size);
+  auto length = load_u32(data.data() + kMagic.size());
+  auto header = data.substr(kPreambleSize, length);
+  if (!data.starts_with(kMagic) || header.size() != length ||
+      crc(header) != load_u32(data.data() + kMagic.size() + 4)) {
+    return make_error(GenericErrc::bad_message,
+                      fmt::format("{}: damaged index header", path));
+  }
+  Deserializer d{.buffer = header};
+  IndexHeader decoded{};
+  deserialize(d, decoded);
+  TRYV(d.status());
+  if (decoded.version_ != kFormatVersion) {
+    return make_error(GenericErrc::bad_message,
+                      fmt::format("{}: index format {}, expected {}", path,
+                                  decoded.version_, kFormatVersion));
+  }
+  file.data_ = align_up(kPreambleSize + length);
+  for (auto& entry : decoded.sections_) {
+    if (entry.offset_ > size || entry.size_ > size ||
+        file.data_ + entry.offset_ + entry.size_ > size) {
+      return make_error(GenericErrc::bad_message,
+                        fmt::format("{}: section {} past the end", path,
+                                    entry.id_));
+    }
+  }
+  file.identity_ = decoded.identity_;
+  file.sections_ = std::move(decoded.sections_);
+  return file;
+}
+
+IndexFile::IndexFile(IndexFile&& other) noexcept
+    : addr_(std::exchange(other.addr_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      data_(other.data_),
+      identity_(other.identity_),
+      sections_(std::move(other.sections_)) {}
+
+IndexFile& IndexFile::operator=(IndexFile&& other) noexcept {
+  if (this != &other) {
+    if (addr_ != nullptr) {
+      munmap(addr_, size_);
+    }
+    addr_ = std::exchange(other.addr_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    data_ = other.data_;
+    identity_ = other.identity_;
+    sections_ = std::move(other.sections_);
+  }
+  return *this;
+}
+
+IndexFile::~IndexFile() {
+  if (addr_ != nullptr) {
+    munmap(addr_, size_);
+  }
+}
+
+std::string_view IndexFile::bytes(const Entry& entry) const {
+  return {static_cast<const char*>(addr_) + data_ + entry.offset_,
+          entry.size_};
+}
+
+Result<std::string_view> IndexFile::section(IndexSection id,
+                                            uint32_t version) const {
+  auto it = std::find_if(sections_.begin(), sections_.end(), [&](auto& e) {
+    return e.id_ == static_cast<uint32_t>(id);
+  });
+  if (it == sections_.end() || it->version_ != version) {
+    return make_error(GenericErrc::no_message,
+                      lazy_format("no section {} version {}",
+                                  static_cast<uint32_t>(id), version));
+  }
+  auto data = bytes(*it);
+  if (crc(data) != it->crc_) {
+    return make_error(GenericErrc::bad_message,
+                      lazy_format("section {} fails its checksum",
+                                  static_cast<uint32_t>(id)));
+  }
+  return data;
+}
+
+Result<void> save_index_section(const char* path, const FileIdentity& identity,
+                                 IndexSection id, uint32_t version,
+                                 const std::vector<iovec>& pieces) {
+  static constexpr char kPadding[kAlignment] = {};
+  IndexHeader header{
+      .version_ = kFormatVersion,
+      .identity_ = identity,
+      .sections_ = {},
+  };
+  // the pieces of each section, padded to kAlignment
+  std::vector<iovec> body;
+  uint64_t offset = 0;
+  auto add = [&](IndexFile::Entry entry, auto&& section_pieces) {
+    entry.offset_ = offset;
+    entry.size_ = 0;
+    entry.crc_ = 0;
+    for (auto& iov : section_pieces) {
+      std::string_view piece(static_cast<const char*>(iov.iov_base),
+                             iov.iov_len);
+      entry.crc_ = crc(piece, entry.crc_);
+      entry.size_ += piece.size();
+      body.push_back(iov);
+    }
+    offset += align_up(entry.size_);
+    if (auto pad = align_up(entry.size_) - entry.size_; pad != 0) {
+      body.push_back(iovec{const_cast<char*>(kPadding), pad});  // NOLINT
+    }
+    header.sections_.push_back(entry);
+  };
+
+  // keeps the sections carried over mapped until the rename
+  auto old = IndexFile::open(path);
+  if (old && old.value().identity() == identity) {
+    for (auto& entry : old.value().sections()) {
+      if (entry.id_ != static_cast<uint32_t>(id)) {
+        auto data = old.value().bytes(entry);
+        add(entry, std::vector<iovec>{
+                       iovec{const_cast<char*>(data.data()),  // NOLINT
+                             data.size()}});
+      }
+    }
+  }
+  add(IndexFile::Entry{.id_ = static_cast<uint32_t>(id),
+                       .version_ = version,
+                       .offset_ = 0,
+                       .size_ = 0,
+                       .crc_ = 0},
+      pieces);
+
+  Serializer s;
+  serialize(s, header);
+  auto encoded = s.take();
+  std::string preamble(kMagic);
+  preamble.resize(kPreambleSize);
+  store_u32(preamble.data() + kMagic.size(),
+            static_cast<uint32_t>(encoded.size()));
+  store_u32(preamble.data() + kMagic.size() + 4, crc(encoded));
+  auto pad = align_up(kPreambleSize + encoded.size()) -
+             (kPreambleSize + encoded.size());
+
+  std::vector<iovec> file{
+      iovec{preamble.data(), preamble.size()},
+      iovec{encoded.data(), encoded.size()},
+      iovec{const_cast<char*>(kPadding), pad},  // NOLINT
+  };
+  file.insert(file.end(), body.begin(), body.end());
+  return write_file_atomic(path, file);
+}
+
+}  // namespace oned
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "file_util.hh"
+#include "noncopyable.hh"
+#include "outcome.hh"
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace oned {
+
+// What an index file may hold about a log, at most one of each.
+enum class IndexSection : uint32_t {
+  line_index = 1,
+  seek_index = 2,
+};
+
+// One file of everything derived from a log, stamped with the identity of
+// the log. Layout:
+//
+//   "ONEDIDX\0"
+//   u32 header length, u32 crc32 of the header
+//   header: serde encoded format version, FileIdentity and section table
+//   sections, each 8-byte aligned, with their own crc32 in the table
+//
+// Opening maps the file and decodes the header only, a section is checked
+// and handed out when asked for.
+class IndexFile : NonCopyable {
+public:
+  struct Entry {
+    uint32_t id_;
+    // of the section's own encoding
+    uint32_t version_;
+    // from the first section
+    uint64_t offset_;
+    uint64_t size_;
+    uint32_t crc_;
+  };
+
+  // Fails with bad_message for anything but an intact header of this
+  // format version.
+  static Result<IndexFile> open(const char* path);
+
+  IndexFile(IndexFile&& other) noexcept;
+  IndexFile& operator=(IndexFile&& other) noexcept;
+  ~IndexFile();
+
+  const FileIdentity& identity() const {
+    return identity_;
+  }
+
+  const std::vector<Entry>& sections() const {
+    return sections_;
+  }
+
+  // The encoding of `id`, valid as long as this IndexFile. Fails with
+  // no_message when there is none of `version`, bad_message when it is
+  // damaged.
+  Result<std::string_view> section(IndexSection id, uint32_t version) const;
+
+  // the bytes of `entry` as they are, unchecked
+  std::string_view bytes(const Entry& entry) const;
+
+private:
+  IndexFile(void* addr, uint64_t size) : addr_(addr), size_(size) {}
+
+  void* addr_;
+  uint64_t size_;
+  // where the first section starts
+  uint64_t data_ = 0;
+  FileIdentity identity_;
+  std::vector<Entry> sections_;
+};
+
+// Store `pieces` as section `id` of the index file at `path`, replacing
+// the file atomically. Other sections are kept when the file was written
+// for the same `identity`, so e.g. the seek points and the line index of a
+// .gz share one file.
+Result<void> save_index_section(const char* path, const FileIdentity& identity,
+                                IndexSection id, uint32_t version,
+                                const std::vector<iovec>& pieces);
+
+}  // namespace oned
@@ -0,0 +1,115 @@
+#include "index_file.hh"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace oned;
+
+class IndexFileTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    path_ = ::testing::TempDir() + "index_file";
+    std::remove(path_.c_str());
+  }
+
+  void TearDown() override {
+    std::remove(path_.c_str());
+  }
+
+  Result<void> save(const FileIdentity& identity, IndexSection id,
+                    std::string_view data, uint32_t version = 1) {
+    return save_index_section(
+        path_.c_str(), identity, id, version,
+        {iovec{const_cast<char*>(data.data()), data.size()}});  // NOLINT
+  }
+
+  static std::string read(const IndexFile& file, IndexSection id,
+                          uint32_t version = 1) {
+    auto data = file.section(id, version);
+    return data ? std::string(data.value()) : std::string();
+  }
+
+  std::string path_;
+};
+
+TEST_F(IndexFileTest, sections) {
+  FileIdentity identity{.size_ = 100, .mtime_ns_ = 5};
+  ASSERT_TRUE(save(identity, IndexSection::line_index, "lines"));
+  ASSERT_TRUE(save(identity, IndexSection::seek_index, "seek points"));
+
+  auto file = IndexFile::open(path_.c_str());
+  ASSERT_TRUE(file);
+  ASSERT_EQ(file.value().identity(), identity);
+  ASSERT_EQ(read(file.value(), IndexSection::line_index), "lines");
+  ASSERT_EQ(read(file.value(), IndexSection::seek_index), "seek points");
+  // another version of a section counts as missing
+  ASSERT_EQ(file.value().section(IndexSection::line_index, 2).error(),
+            GenericErrc::no_message);
+
+  // replacing one section keeps the other
+  ASSERT_TRUE(save(identity, IndexSection::line_index, "new lines"));
+  file = IndexFile::open(path_.c_str());
+  ASSERT_TRUE(file);
+  ASSERT_EQ(read(file.value(), IndexSection::line_index), "new lines");
+  ASSERT_EQ(read(file.value(), IndexSection::seek_index), "seek points");
+
+  // unless the log changed
+  identity.mtime_ns_++;
+  ASSERT_TRUE(save(identity, IndexSection::line_index, "lines"));
+  file = IndexFile::open(path_.c_str());
+  ASSERT_TRUE(file);
+  ASSERT_EQ(file.value().sections().size(), 1);
+  ASSERT_EQ(read(file.value(), IndexSection::line_index), "lines");
+}
+
+TEST_F(IndexFileTest, damage) {
+  FileIdentity identity{.size_ = 100, .mtime_ns_ = 5};
+  ASSERT_TRUE(save(identity, IndexSection::line_index, "lines"));
+  ASSERT_TRUE(save(identity, IndexSection::seek_index, "seek points"));
+  auto data = read_whole_file(path_.c_str());
+  ASSERT_TRUE(data);
+  auto damaged = data.value();
+
+  // a flipped byte in a section fails that section only
+  damaged[damaged.find("seek points")] ^= 1;
+  ASSERT_TRUE(write_file_atomic(path_.c_str(), damaged));
+  auto file = IndexFile::open(path_.c_str());
+  ASSERT_TRUE(file);
+  ASSERT_EQ(read(file.value(), IndexSection::line_index), "lines");
+  ASSERT_EQ(file.value().section(IndexSection::seek_index, 1).error(),
+            GenericErrc::bad_message);
+
+  // cut anywhere before the end of the last section it fails to open
+  auto end = data.value().find("seek points") + std::strlen("seek points");
+  for (std::size_t n = 0; n < end; n++) {
+    ASSERT_TRUE(write_file_atomic(path_.c_str(),
+                                  std::string_view(data.value()).substr(0, n)));
+    ASSERT_FALSE(IndexFile::open(path_.c_str())) << n;
+  }
+}
+
+TEST_F(IndexFileTest, identity_hashes_contents) {
+  auto log = path_ + ".log";
+  ASSERT_TRUE(write_file_atomic(log.c_str(), std::string(10000, 'a')));
+  auto before = file_identity(log.c_str());
+  ASSERT_TRUE(before);
+
+  // same size and mtime, different tail
+  struct stat st {};
+  ASSERT_EQ(::stat(log.c_str(), &st), 0);
+  ASSERT_TRUE(write_file_atomic(log.c_str(),
+                                std::string(9999, 'a') + "b"));
+  timespec times[2] = {st.st_atim, st.st_mtim};
+  ASSERT_EQ(::utimensat(AT_FDCWD, log.c_str(), times, 0), 0);
+  auto after = file_identity(log.c_str());
+  ASSERT_TRUE(after);
+  EXPECT_EQ(after.value().size_, before.value().size_);
+  EXPECT_EQ(after.value().mtime_ns_, before.value().mtime_ns_);
+  EXPECT_EQ(after.value().head_hash_, before.value().head_hash_);
+  EXPECT_NE(after.value().tail_hash_, before.value().tail_hash_);
+  std::remove(log.c_str());
+}
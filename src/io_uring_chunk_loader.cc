@@ -0,0 +1,478 @@
+#include "io_uring_chunk_loader.hh"
+#include "noncopyable.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define ONED_HAVE_IO_URING 1
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <numeric>
+
+namespace oned {
+
+static Result<void> pread_full(int fd, char* buf, uint64_t offset,
+                               uint32_t length) {
+  uint32_t done = 0;
+  while (done < length) {
+    auto n = pread(fd, buf + done, length - done,
+                   static_cast<off_t>(offset + done));
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno_to_errc(errno);
+    }
+    if (n == 0) {
+      return make_error(GenericErrc::io_error,
+                        lazy_format("unexpected EOF when reading at {}~{}",
+                                    offset, length));
+    }
+    done += n;
+  }
+  return outcome::success();
+}
+
+// Keep memory the kernel may still write into alive for good, reachable so
+// leak checkers stay quiet. Moving a vector or a unique_ptr keeps the
+// addresses handed to the kernel.
+template <typename T>
+static void abandon(T&& t) {
+  static std::mutex mutex;
+  static auto* abandoned = new std::vector<std::shared_ptr<void>>();  // NOLINT
+  std::lock_guard lock(mutex);
+  abandoned->push_back(std::make_shared<std::decay_t<T>>(std::forward<T>(t)));
+}
+
+#ifdef ONED_FAULT_INJECTION
+
+// NOLINTBEGIN
+static std::atomic<uint32_t> injected_enter_failures{0};
+static std::mutex injected_enter_mutex;
+static uint32_t injected_enter_skip = 0;
+static int injected_enter_errno = 0;
+// NOLINTEND
+
+void inject_io_uring_enter_error(int err, uint32_t skip, uint32_t count) {
+  std::lock_guard lock(injected_enter_mutex);
+  injected_enter_errno = err;
+  injected_enter_skip = skip;
+  injected_enter_failures.store(count, std::memory_order_relaxed);
+}
+
+[[maybe_unused]] static int take_injected_enter_error() {
+  if (injected_enter_failures.load(std::memory_order_relaxed) == 0) {
+    return 0;
+  }
+  std::lock_guard lock(injected_enter_mutex);
+  if (injected_enter_skip > 0) {
+    injected_enter_skip--;
+    return 0;
+  }
+  if (injected_enter_failures.load(std::memory_order_relaxed) == 0) {
+    return 0;
+  }
+  injected_enter_failures.fetch_sub(1, std::memory_order_relaxed);
+  return injected_enter_errno;
+}
+
+#endif
+
+#ifdef ONED_HAVE_IO_URING
+
+// Just enough of an io_uring to submit reads and reap their completions.
+class IoUring : NonCopyable {
+public:
+  static Result<std::unique_ptr<IoUring>> create(uint32_t entries) {
+    io_uring_params p{};
+    auto fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd < 0) {
+      return errno_to_errc(errno);
+    }
+
+    auto ring = std::unique_ptr<IoUring>(new IoUring(fd));
+    ring->sq_entries_ = p.sq_entries;
+    ring->sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      ring->sq_ring_size_ = ring->cq_ring_size_ =
+          std::max(ring->sq_ring_size_, ring->cq_ring_size_);
+    }
+
+    auto map = [fd](std::size_t size, off_t offset) -> Result<char*> {
+      auto addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, offset);
+      if (addr == MAP_FAILED) {  // NOLINT
+        return errno_to_errc(errno);
+      }
+      return static_cast<char*>(addr);
+    };
+    ring->sq_ring_ = TRYX(map(ring->sq_ring_size_, IORING_OFF_SQ_RING));
+    if (single_mmap) {
+      ring->cq_ring_ = ring->sq_ring_;
+    } else {
+      ring->cq_ring_ = TRYX(map(ring->cq_ring_size_, IORING_OFF_CQ_RING));
+    }
+    ring->sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes_ = reinterpret_cast<io_uring_sqe*>(  // NOLINT
+        TRYX(map(ring->sqes_size_, IORING_OFF_SQES)));
+
+    auto* sq = ring->sq_ring_;
+    auto* cq = ring->cq_ring_;
+    // NOLINTBEGIN
+    ring->sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    ring->sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    ring->sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    ring->sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    ring->cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    ring->cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    ring->cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    ring->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    // NOLINTEND
+    return ring;
+  }
+
+  IoUring(IoUring&&) = delete;
+  IoUring& operator=(IoUring&&) = delete;
+
+  ~IoUring() {
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != nullptr) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    close(ring_fd_);
+  }
+
+  uint32_t capacity() const {
+    return sq_entries_;
+  }
+
+  // The caller keeps at most capacity() reads in flight.
+  void prepare_readv(int fd, const iovec* iov, uint64_t offset,
+                     uint64_t user_data) {
+    auto tail = *sq_tail_;
+    auto index = tail & sq_mask_;
+    auto& sqe = sqes_[index];  // NOLINT
+    sqe = io_uring_sqe{};
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = fd;
+    sqe.off = offset;
+    sqe.addr = reinterpret_cast<uint64_t>(iov);  // NOLINT
+    sqe.len = 1;
+    sqe.user_data = user_data;
+    sq_array_[index] = index;  // NOLINT
+    std::atomic_ref(*sq_tail_).store(tail + 1, std::memory_order_release);
+  }
+
+  // Submit everything prepared and wait for at least `wait` completions.
+  // Returns 0 or the errno io_uring_enter failed with, EINTR is retried.
+  int submit_and_wait(uint32_t wait) {
+    while (true) {
+#ifdef ONED_FAULT_INJECTION
+      if (auto e = take_injected_enter_error(); e != 0) {
+        return e;
+      }
+#endif
+      auto pending = *sq_tail_ -
+                     std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+      auto ret = syscall(__NR_io_uring_enter, ring_fd_, pending, wait,
+                         IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret >= 0) {
+        return 0;
+      }
+      if (errno != EINTR) {
+        return errno;
+      }
+    }
+  }
+
+  // Drops prepared entries the kernel has not consumed yet, so a failed
+  // submit doesn't leak them into the next one. Returns how many.
+  uint32_t discard_unsubmitted() {
+    auto head = std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+    auto n = *sq_tail_ - head;
+    std::atomic_ref(*sq_tail_).store(head, std::memory_order_release);
+    return n;
+  }
+
+  // Calls `f(user_data, res)` for every completion available.
+  template <typename F>
+  void reap(F&& f) {
+    auto head = *cq_head_;
+    auto tail = std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      auto& cqe = cqes_[head & cq_mask_];  // NOLINT
+      f(cqe.user_data, cqe.res);
+    }
+    std::atomic_ref(*cq_head_).store(head, std::memory_order_release);
+  }
+
+private:
+  explicit IoUring(int fd) : ring_fd_(fd) {}
+
+  int ring_fd_;
+  uint32_t sq_entries_ = 0;
+  char* sq_ring_ = nullptr;
+  std::size_t sq_ring_size_ = 0;
+  char* cq_ring_ = nullptr;
+  std::size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  std::size_t sqes_size_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+#else
+
+class IoUring {};
+
+#endif
+
+class IoUringChunkLoader final : public ChunkLoader, NonCopyable {
+public:
+  IoUringChunkLoader(int fd, uint64_t file_size, std::unique_ptr<IoUring> ring)
+      : fd_(fd), file_size_(file_size), ring_(std::move(ring)) {}
+
+  IoUringChunkLoader(IoUringChunkLoader&&) = delete;
+  IoUringChunkLoader& operator=(IoUringChunkLoader&&) = delete;
+
+  ~IoUringChunkLoader() final {
+    ring_.reset();
+    close(fd_);
+  }
+
+  uint64_t size() const final {
+    return file_size_.load(std::memory_order_acquire);
+  }
+
+  Result<uint64_t> refresh_size() final {
+    struct stat st {};
+    if (fstat(fd_, &st) == -1) {
+      return errno_to_errc(errno);
+    }
+    auto size = static_cast<uint64_t>(st.st_size);
+    if (size > file_size_.load(std::memory_order_relaxed)) {
+      file_size_.store(size, std::memory_order_release);
+    }
+    return file_size_.load(std::memory_order_relaxed);
+  }
+
+  Result<std::string> read_chunk(uint64_t offset, uint32_t length) final {
+    std::string data;
+    data.resize(length);
+    TRYV(pread_full(fd_, data.data(), offset, length));
+    return data;
+  }
+
+  Result<void> read_chunk_into(uint64_t offset, std::span<char> out) final {
+    return pread_full(fd_, out.data(), offset,
+                      static_cast<uint32_t>(out.size()));
+  }
+
+  Result<std::vector<std::string>> read_chunks(
+      const std::vector<ChunkRange>& ranges) final {
+    std::vector<std::string> ret(ranges.size());
+    std::vector<std::span<char>> outs(ranges.size());
+    for (std::size_t i = 0; i < ranges.size(); i++) {
+      ret[i].resize(ranges[i].length_);
+      outs[i] = ret[i];
+    }
+    auto r = read_chunks_into(ranges, outs);
+    if (!r) {
+      if (r.error() == GenericErrc::state_not_recoverable) {
+        // the kernel may still write into them
+        abandon(std::move(ret));
+      }
+      return std::move(r).error();
+    }
+    return ret;
+  }
+
+  Result<void> read_chunks_into(
+      const std::vector<ChunkRange>& ranges,
+      const std::vector<std::span<char>>& outs) final {
+#ifdef ONED_HAVE_IO_URING
+    std::unique_lock lock(ring_mutex_);
+    if (ring_ != nullptr) {
+      return read_io_uring(ranges, outs);
+    }
+    lock.unlock();
+#endif
+    return read_preadv(ranges, outs);
+  }
+
+private:
+#ifdef ONED_HAVE_IO_URING
+  // ring_mutex_ held.
+  Result<void> read_io_uring(const std::vector<ChunkRange>& ranges,
+                             const std::vector<std::span<char>>& bufs) {
+    std::vector<iovec> iovs(ranges.size());
+
+    Result<void> status = outcome::success();
+    std::size_t next = 0;
+    uint32_t inflight = 0;
+    // keep reaping after a failure, the kernel still writes into `bufs` and
+    // `iovs` until every submitted read completes
+    while (inflight > 0 || (status && next < ranges.size())) {
+      while (status && next < ranges.size() && inflight < ring_->capacity()) {
+        iovs[next] = iovec{bufs[next].data(), ranges[next].length_};
+        ring_->prepare_readv(fd_, &iovs[next], ranges[next].offset_, next);
+        next++;
+        inflight++;
+      }
+
+      auto err = ring_->submit_and_wait(1);
+      // EAGAIN and EBUSY clear once completions are reaped
+      if (err != 0 && err != EAGAIN && err != EBUSY) {
+        if (!status) {
+          // No way to wait for the reads still writing into `iovs` and
+          // `bufs`, so leak them along with the ring, the caller leaks
+          // `bufs`. Later batches take preadv.
+          abandon(std::move(iovs));
+          abandon(std::move(ring_));
+          return make_error(
+              GenericErrc::state_not_recoverable,
+              lazy_format("io_uring_enter failed with errno {}, {} reads "
+                          "still in flight",
+                          err, inflight));
+        }
+        status = errno_to_errc(err);
+        inflight -= ring_->discard_unsubmitted();
+      }
+      ring_->reap([&](uint64_t i, int32_t res) {
+        inflight--;
+        if (!status) {
+          return;
+        }
+        if (res < 0) {
+          status = errno_to_errc(-res);
+          return;
+        }
+        // finish short reads synchronously, they only happen near EOF
+        auto& r = ranges[i];
+        auto n = static_cast<uint32_t>(res);
+        if (n < r.length_) {
+          status = pread_full(fd_, bufs[i].data() + n, r.offset_ + n,
+                              r.length_ - n);
+        }
+      });
+    }
+    return status;
+  }
+#endif
+
+  // One preadv per run of ranges that are adjacent in the file.
+  Result<void> read_preadv(const std::vector<ChunkRange>& ranges,
+                           const std::vector<std::span<char>>& bufs) {
+    std::vector<std::size_t> order(ranges.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+      return ranges[a].offset_ < ranges[b].offset_;
+    });
+
+    std::vector<iovec> iovs;
+    std::size_t begin = 0;
+    while (begin < order.size()) {
+      auto end = begin + 1;
+      auto run_end = ranges[order[begin]].offset_ + ranges[order[begin]].length_;
+      while (end < order.size() && end - begin < IOV_MAX &&
+             ranges[order[end]].offset_ == run_end) {
+        run_end += ranges[order[end]].length_;
+        end++;
+      }
+
+      iovs.clear();
+      for (auto i = begin; i < end; i++) {
+        iovs.push_back(iovec{bufs[order[i]].data(), ranges[order[i]].length_});
+      }
+      auto offset = ranges[order[begin]].offset_;
+      ssize_t n = -1;
+      do {
+        n = preadv(fd_, iovs.data(), static_cast<int>(iovs.size()),
+                   static_cast<off_t>(offset));
+      } while (n == -1 && errno == EINTR);
+      if (n == -1) {
+        return errno_to_errc(errno);
+      }
+
+      // finish whatever a short read left behind
+      auto done = static_cast<uint64_t>(n);
+      for (auto i = begin; i < end; i++) {
+        auto& r = ranges[order[i]];
+        auto got = static_cast<uint32_t>(std::min<uint64_t>(done, r.length_));
+        done -= got;
+        if (got < r.length_) {
+          TRYV(pread_full(fd_, bufs[order[i]].data() + got, r.offset_ + got,
+                          r.length_ - got));
+        }
+      }
+      begin = end;
+    }
+    return outcome::success();
+  }
+
+  int fd_;
+  std::atomic<uint64_t> file_size_;
+  std::mutex ring_mutex_;
+  std::unique_ptr<IoUring> ring_;
+};
+
+Result<ChunkLoaderPtr> open_io_uring_loader(const char* path,
+                                            bool use_io_uring) {
+  auto fd = ::open(path, O_RDONLY | O_CLOEXEC);  // NOLINT
+  if (fd == -1) {
+    return errno_to_errc(errno);
+  }
+
+  struct stat st {};
+  if (fstat(fd, &st) == -1) {
+    auto e = errno;
+    close(fd);
+    return errno_to_errc(e);
+  }
+
+  std::unique_ptr<IoUring> ring;
+#ifdef ONED_HAVE_IO_URING
+  static constexpr uint32_t kRingEntries = 64;
+  if (use_io_uring) {
+    // any failure here just means preadv
+    if (auto r = IoUring::create(kRingEntries)) {
+      ring = std::move(r).value();
+    }
+  }
+#else
+  (void)use_io_uring;
+#endif
+
+  return std::make_unique<IoUringChunkLoader>(
+      fd, static_cast<uint64_t>(st.st_size), std::move(ring));
+}
+
+}  // namespace oned
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "chunk.hh"
+
+namespace oned {
+
+// Reads single chunks with pread and submits a whole read_chunks batch to one
+// io_uring. Without io_uring (old kernel, seccomp, or `use_io_uring` unset)
+// batches fall back to preadv over runs of adjacent ranges.
+Result<ChunkLoaderPtr> open_io_uring_loader(const char* path,
+                                            bool use_io_uring = true);
+
+#ifdef ONED_FAULT_INJECTION
+// For tests: after `skip` more calls go through, the next `count` calls to
+// io_uring_enter fail with `err` before reaching the kernel.
+void inject_io_uring_enter_error(int err, uint32_t skip, uint32_t count = 1);
+#endif
+
+}  // namespace oned
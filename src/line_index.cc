@@ -0,0 +1,197 @@
+#include "line_index.hh"
+#include "byte_scan.hh"
+#include "file_util.hh"
+#include "index_file.hh"
+#include "serde.hh"
+
+#include <algorithm>
+
+namespace oned {
+
+static constexpr uint32_t kLineIndexVersion = 3;
+
+template <>
+inline constexpr bool kBlockSerde<LineCheckpoint> = true;
+
+// the IndexSection::line_index of an index file
+struct SavedLineIndex {
+  // contents size as seen through the ChunkManager, differs for compressed
+  // files
+  uint64_t size_;
+  uint64_t stride_;
+  uint64_t span_;
+  uint64_t line_count_;
+  uint64_t newlines_;
+  char last_byte_;
+  std::vector<LineCheckpoint> checkpoints_;
+};
+
+// Run `f(offset, data)` over [start, end) one chunk at a time until it
+// returns true.
+template <typename F>
+static Result<void> scan(ChunkManager &mgr, uint64_t start, uint64_t end,
+                         F &&f) {
+  auto chunk_size = mgr.chunk_size();
+  while (start < end) {
+    auto id = static_cast<ChunkID>(start / chunk_size);
+    auto off = static_cast<uint32_t>(start % chunk_size);
+    auto len = static_cast<uint32_t>(
+        std::min<uint64_t>(chunk_size - off, end - start));
+    auto handle = TRYX(mgr.get_chunk(ChunkView{
+        .id_ = id,
+        .offset_ = off,
+        .length_ = len,
+    }));
+    if (f(start, handle.view())) {
+      break;
+    }
+    start += len;
+  }
+  return outcome::success();
+}
+
+Result<void> LineIndex::extend() {
+  auto size = mgr_->size();
+  if (checkpoints_.empty()) {
+    checkpoints_.push_back(LineCheckpoint{.offset_ = 0, .line_ = 0});
+  }
+  auto last = checkpoints_.back().offset_;
+  // newlines left until the next stride checkpoint
+  uint64_t pending = stride_ - newlines_ % stride_;
+  TRYV(scan(*mgr_, indexed_, size, [&](uint64_t base, std::string_view data) {
+    for (size_t pos = 0;;) {
+      auto wanted = pending;
+      auto found = find_nth_newline(data.substr(pos), pending);
+      newlines_ += wanted - pending;
+      if (found == std::string_view::npos) {
+        break;
+      }
+      pos += found + 1;
+      pending = stride_;
+      last = base + pos;
+      checkpoints_.push_back({.offset_ = last, .line_ = newlines_});
+    }
+    auto chunk_end = base + data.size();
+    if (chunk_end - last >= span_ && chunk_end < size) {
+      last = chunk_end;
+      checkpoints_.push_back({.offset_ = last, .line_ = newlines_});
+    }
+    last_byte_ = data.back();
+    indexed_ = chunk_end;
+    return false;
+  }));
+  line_count_ = newlines_ + (last_byte_ != '\n' ? 1 : 0);
+  return outcome::success();
+}
+
+Result<LineIndex> LineIndex::open(ChunkManager &mgr, const char *path,
+                                  LineIndexOptions options) {
+  auto stride = std::max<uint64_t>(options.stride, 1);
+  auto span = std::max<uint64_t>(options.span, mgr.chunk_size());
+  auto identity = TRYX(file_identity(path));
+
+  LineIndex index(mgr, stride, span);
+  if (options.index_path != nullptr) {
+    auto file = IndexFile::open(options.index_path);
+    // a log that only grew keeps its index, extend() scans the rest
+    auto grown = [&] {
+      auto r = appended_to(path, file.value().identity());
+      return r && r.value();
+    };
+    if (file && (file.value().identity() == identity || grown())) {
+      if (auto data = file.value().section(IndexSection::line_index,
+                                           kLineIndexVersion);
+          data) {
+        Deserializer d{.buffer = data.value()};
+        SavedLineIndex saved{};
+        deserialize(d, saved);
+        if (d.status() && saved.size_ <= mgr.size() &&
+            saved.stride_ == stride && saved.span_ == span &&
+            !saved.checkpoints_.empty()) {
+          index.line_count_ = saved.line_count_;
+          index.checkpoints_ = std::move(saved.checkpoints_);
+          index.indexed_ = saved.size_;
+          index.newlines_ = saved.newlines_;
+          index.last_byte_ = saved.last_byte_;
+          if (saved.size_ == mgr.size()) {
+            return index;
+          }
+        }
+      }
+    }
+  }
+
+  TRYV(index.extend());
+  if (options.index_path != nullptr) {
+    SavedLineIndex saved{
+        .size_ = mgr.size(),
+        .stride_ = stride,
+        .span_ = span,
+        .line_count_ = index.line_count_,
+        .newlines_ = index.newlines_,
+        .last_byte_ = index.last_byte_,
+        .checkpoints_ = std::move(index.checkpoints_),
+    };
+    // the checkpoints are written straight from the vector
+    static constexpr std::size_t kGatherThreshold = 1024;
+    Serializer s({.gather_threshold = kGatherThreshold});
+    s.reserve(buffered_size(saved, kGatherThreshold));
+    serialize(s, saved);
+    // the index works without being saved, it's only slower to reopen
+    (void)save_index_section(options.index_path, identity,
+                             IndexSection::line_index, kLineIndexVersion,
+                             s.iovecs());
+    index.checkpoints_ = std::move(saved.checkpoints_);
+  }
+  return index;
+}
+
+Result<uint64_t> LineIndex::line_to_offset(uint64_t line) const {
+  if (line >= line_count_) {
+    return make_error(GenericErrc::result_out_of_range,
+                      lazy_format("line {} of {}", line, line_count_));
+  }
+  if (line == 0) {
+    return 0;
+  }
+  // the last checkpoint in front of the line's newline
+  auto iter = std::upper_bound(
+      checkpoints_.begin(), checkpoints_.end(), line - 1,
+      [](uint64_t l, const LineCheckpoint &cp) { return l < cp.line_; });
+  const auto &cp = *std::prev(iter);
+  auto remaining = line - cp.line_;
+  uint64_t offset = 0;
+  TRYV(scan(*mgr_, cp.offset_, mgr_->size(),
+            [&](uint64_t base, std::string_view data) {
+              auto found = find_nth_newline(data, remaining);
+              if (found == std::string_view::npos) {
+                return false;
+              }
+              offset = base + found + 1;
+              return true;
+            }));
+  if (remaining != 0) {
+    return make_error(GenericErrc::io_error, "file changed under line index");
+  }
+  return offset;
+}
+
+Result<uint64_t> LineIndex::offset_to_line(uint64_t offset) const {
+  if (offset >= indexed_) {
+    return make_error(GenericErrc::result_out_of_range,
+                      lazy_format("offset {} of {}", offset, indexed_));
+  }
+  auto iter = std::upper_bound(
+      checkpoints_.begin(), checkpoints_.end(), offset,
+      [](uint64_t off, const LineCheckpoint &cp) { return off < cp.offset_; });
+  const auto &cp = *std::prev(iter);
+  auto line = cp.line_;
+  TRYV(scan(*mgr_, cp.offset_, offset,
+            [&](uint64_t, std::string_view data) {
+              line += count_byte(data, '\n');
+              return false;
+            }));
+  return line;
+}
+
+}  // namespace oned
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "chunk_manager.hh"
+#include "noncopyable.hh"
+
+#include <cstdint>
+#include <vector>
+
+namespace oned {
+
+struct LineIndexOptions {
+  // A checkpoint is recorded at the start of every `stride` lines...
+  uint64_t stride = 1024;
+  // ...and at the first chunk boundary `span` bytes past the previous one,
+  // so lookups scan at most about `stride` lines or `span` bytes.
+  uint64_t span = uint64_t(1) << 20;
+  // Where the index is loaded from, or saved to after a build. Null keeps
+  // the index in memory only.
+  const char *index_path = nullptr;
+};
+
+struct LineCheckpoint {
+  uint64_t offset_;
+  // newlines in front of offset_
+  uint64_t line_;
+};
+
+// Sparse newline table over the contents of a ChunkManager. Lines are
+// numbered from 0, line n starts right after the n-th newline.
+class LineIndex : NonCopyable {
+public:
+  // Stream the whole file through `mgr` once, or reuse the saved index when
+  // it was built from `path` as it is now.
+  static Result<LineIndex> open(ChunkManager &mgr, const char *path,
+                                LineIndexOptions options = {});
+
+  // A trailing line without newline counts, an empty file has no lines.
+  uint64_t line_count() const {
+    return line_count_;
+  }
+
+  // Index the data appended since the last build or extend, e.g. after
+  // ChunkManager::refresh. Lookups must not run concurrently.
+  Result<void> extend();
+
+  // Offset of the first byte of `line`.
+  Result<uint64_t> line_to_offset(uint64_t line) const;
+
+  // The line holding the byte at `offset`.
+  Result<uint64_t> offset_to_line(uint64_t offset) const;
+
+  const std::vector<LineCheckpoint> &checkpoints() const {
+    return checkpoints_;
+  }
+
+private:
+  LineIndex(ChunkManager &mgr, uint64_t stride, uint64_t span)
+      : mgr_(&mgr), stride_(stride), span_(span) {}
+
+  ChunkManager *mgr_;
+  uint64_t stride_;
+  uint64_t span_;
+  uint64_t line_count_ = 0;
+  std::vector<LineCheckpoint> checkpoints_;
+
+  // where extend() picks up
+  uint64_t indexed_ = 0;
+  uint64_t newlines_ = 0;
+  char last_byte_ = '\n';
+};
+
+}  // namespace oned
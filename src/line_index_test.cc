@@ -0,0 +1,152 @@
+#include "line_index.hh"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+using namespace oned;
+
+class LineIndexTest : public ::testing::Test {
+protected:
+  // set once, LineIndexOptions keeps pointers into them
+  void SetUp() override {
+    path_ = ::testing::TempDir() + "line_index";
+    index_path_ = path_ + ".lines";
+  }
+
+  void TearDown() override {
+    std::remove(path_.c_str());
+    std::remove(index_path_.c_str());
+  }
+
+  void write_file(const std::string& data, const char* mode = "wb") {
+    data_ = mode[0] == 'a' ? data_ + data : data;
+    auto* f = std::fopen(path_.c_str(), mode);
+    ASSERT_NE(f, nullptr);
+    std::fwrite(data.data(), 1, data.size(), f);
+    std::fclose(f);
+
+    auto loader = ChunkLoader::open(path_.c_str(),
+                                    {.kind = ChunkLoaderKind::stdio});
+    ASSERT_TRUE(loader);
+    mgr_ = std::make_unique<ChunkManager>(std::move(loader).value(), 64,
+                                          64 * 8);
+  }
+
+  // lines with lengths from 0 to a few chunks, so checkpoints land both on
+  // line starts and in the middle of long lines
+  static std::string random_lines(int count, bool trailing_newline) {
+    std::mt19937 rng(42);
+    std::string data;
+    for (int i = 0; i < count; i++) {
+      auto len = rng() % 8 == 0 ? rng() % 300 : rng() % 20;
+      data.append(len, static_cast<char>('a' + i % 26));
+      data += '\n';
+    }
+    if (!trailing_newline) {
+      data += "tail";
+    }
+    return data;
+  }
+
+  // compare against a plain scan of data_
+  void check_index(const LineIndex& index) {
+    std::vector<uint64_t> starts;
+    for (uint64_t i = 0; i < data_.size(); i++) {
+      if (i == 0 || data_[i - 1] == '\n') {
+        starts.push_back(i);
+      }
+    }
+    ASSERT_EQ(index.line_count(), starts.size());
+    for (uint64_t line = 0; line < starts.size(); line++) {
+      auto offset = index.line_to_offset(line);
+      ASSERT_TRUE(offset);
+      ASSERT_EQ(offset.value(), starts[line]) << "line " << line;
+    }
+    uint64_t line = 0;
+    for (uint64_t offset = 0; offset < data_.size(); offset++) {
+      if (line + 1 < starts.size() && starts[line + 1] == offset) {
+        line++;
+      }
+      auto l = index.offset_to_line(offset);
+      ASSERT_TRUE(l);
+      ASSERT_EQ(l.value(), line) << "offset " << offset;
+    }
+    EXPECT_FALSE(index.line_to_offset(starts.size()));
+    EXPECT_FALSE(index.offset_to_line(data_.size()));
+  }
+
+  std::string data_;
+  std::string path_;
+  std::string index_path_;
+  std::unique_ptr<ChunkManager> mgr_;
+};
+
+TEST_F(LineIndexTest, Lookup) {
+  for (bool trailing : {true, false}) {
+    SCOPED_TRACE(trailing);
+    write_file(random_lines(2000, trailing));
+    auto index = LineIndex::open(*mgr_, path_.c_str(),
+                                 {.stride = 16, .span = 256});
+    ASSERT_TRUE(index);
+    // both kinds of checkpoints were recorded
+    const auto& cps = index.value().checkpoints();
+    ASSERT_GT(cps.size(), 2000 / 16);
+    check_index(index.value());
+  }
+}
+
+TEST_F(LineIndexTest, EmptyAndSingleLine) {
+  write_file("");
+  auto empty = LineIndex::open(*mgr_, path_.c_str());
+  ASSERT_TRUE(empty);
+  EXPECT_EQ(empty.value().line_count(), 0);
+  EXPECT_FALSE(empty.value().line_to_offset(0));
+
+  write_file("no newline at all");
+  auto single = LineIndex::open(*mgr_, path_.c_str());
+  ASSERT_TRUE(single);
+  check_index(single.value());
+}
+
+TEST_F(LineIndexTest, SavedIndex) {
+  write_file(random_lines(500, true));
+  LineIndexOptions options{
+      .stride = 8, .span = 128, .index_path = index_path_.c_str()};
+  auto built = LineIndex::open(*mgr_, path_.c_str(), options);
+  ASSERT_TRUE(built);
+
+  auto loaded = LineIndex::open(*mgr_, path_.c_str(), options);
+  ASSERT_TRUE(loaded);
+  ASSERT_EQ(loaded.value().line_count(), built.value().line_count());
+  ASSERT_EQ(loaded.value().checkpoints().size(),
+            built.value().checkpoints().size());
+  check_index(loaded.value());
+
+  // a different stride ignores the saved index
+  options.stride = 32;
+  auto rebuilt = LineIndex::open(*mgr_, path_.c_str(), options);
+  ASSERT_TRUE(rebuilt);
+  EXPECT_LT(rebuilt.value().checkpoints().size(),
+            built.value().checkpoints().size());
+  check_index(rebuilt.value());
+
+  // so does a rewritten file
+  write_file(random_lines(100, false));
+  auto changed = LineIndex::open(*mgr_, path_.c_str(), options);
+  ASSERT_TRUE(changed);
+  check_index(changed.value());
+
+  // but one that grew only has its new chunks scanned
+  auto old_size = data_.size();
+  write_file(random_lines(300, true), "ab");
+  auto grown = LineIndex::open(*mgr_, path_.c_str(), options);
+  ASSERT_TRUE(grown);
+  auto new_chunks = (data_.size() + 63) / 64 - old_size / 64;
+  EXPECT_EQ(mgr_->prefetch_stats().misses, new_chunks);
+  check_index(grown.value());
+  auto reopened = LineIndex::open(*mgr_, path_.c_str(), options);
+  ASSERT_TRUE(reopened);
+  EXPECT_EQ(reopened.value().checkpoints().size(),
+            grown.value().checkpoints().size());
+}
@@ -5,13 +5,60 @@
 #include <absl/log/log.h>
 #include <fmt/format.h>
 
-#define IMPL_LOGF_(_log, _serverity, _spec, ...) \
-  _log(_serverity) << fmt::format("[{}] " _spec, \
-                                  __func__ __VA_OPT__(, ) __VA_ARGS__)
-
-#define FATALF(...) IMPL_LOGF_(LOG, FATAL, __VA_ARGS__)
-#define ERRORF(...) IMPL_LOGF_(LOG, ERROR, __VA_ARGS__)
-#define WARNF(...) IMPL_LOGF_(LOG, WARNING, __VA_ARGS__)
-#define INFOF(...) IMPL_LOGF_(VLOG, 0, __VA_ARGS__)
-#define DEBUGF(...) IMPL_LOGF_(VLOG, 1, __VA_ARGS__)
-#define TRACEF(...) IMPL_LOGF_(VLOG, 2, __VA_ARGS__)
+#include <string_view>
+
+// Statements below this level are compiled out, e.g.
+// -DONED_LOG_MIN_LEVEL=2 drops TRACEF and DEBUGF. FATALF always stays.
+#ifndef ONED_LOG_MIN_LEVEL
+#define ONED_LOG_MIN_LEVEL 0
+#endif
+
+namespace oned {
+
+enum class LogLevel : int {
+  trace = 0,
+  debug = 1,
+  info = 2,
+  warning = 3,
+  error = 4,
+  fatal = 5,
+};
+
+inline constexpr bool log_compiled_in(LogLevel level) {
+  return level == LogLevel::fatal ||
+         static_cast<int>(level) >= ONED_LOG_MIN_LEVEL;
+}
+
+// Formats into a buffer per thread, valid until the next call on this
+// thread. A formatter must not log itself.
+inline std::string_view vlog_format(fmt::string_view spec,
+                                    fmt::format_args args) {
+  thread_local fmt::memory_buffer buffer;
+  buffer.clear();
+  fmt::vformat_to(fmt::appender(buffer), spec, args);
+  return {buffer.data(), buffer.size()};
+}
+
+template <typename... Args>
+std::string_view log_format(fmt::format_string<Args...> spec,
+                            Args&&... args) {
+  return vlog_format(spec, fmt::make_format_args(args...));
+}
+
+}  // namespace oned
+
+// absl checks the severity or verbosity before evaluating anything to the
+// right of <<, so a disabled statement costs one branch and its arguments
+// are never evaluated.
+#define IMPL_LOGF_(_level, _log, _serverity, _spec, ...)                     \
+  if constexpr (!::oned::log_compiled_in(::oned::LogLevel::_level)) {        \
+  } else                                                                     \
+    _log(_serverity) << ::oned::log_format("[{}] " _spec,                    \
+                                           __func__ __VA_OPT__(, ) __VA_ARGS__)
+
+#define FATALF(...) IMPL_LOGF_(fatal, LOG, FATAL, __VA_ARGS__)
+#define ERRORF(...) IMPL_LOGF_(error, LOG, ERROR, __VA_ARGS__)
+#define WARNF(...) IMPL_LOGF_(warning, LOG, WARNING, __VA_ARGS__)
+#define INFOF(...) IMPL_LOGF_(info, VLOG, 0, __VA_ARGS__)
+#define DEBUGF(...) IMPL_LOGF_(debug, VLOG, 1, __VA_ARGS__)
+#define TRACEF(...) IMPL_LOGF_(trace, VLOG, 2, __VA_ARGS__)
@@ -0,0 +1,25 @@
+#include "metrics.hh"
+
+namespace oned {
+
+MetricsReporter::MetricsReporter(std::chrono::milliseconds interval,
+                                 std::function<void()> dump)
+    : thread_([this, interval, dump = std::move(dump)] {
+        std::unique_lock lock(mutex_);
+        while (!cv_.wait_for(lock, interval, [&] { return stop_; })) {
+          lock.unlock();
+          dump();
+          lock.lock();
+        }
+      }) {}
+
+MetricsReporter::~MetricsReporter() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+}  // namespace oned
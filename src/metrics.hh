@@ -0,0 +1,176 @@
+#pragma once
+
+#include "noncopyable.hh"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace oned {
+
+// Percentiles are the upper bound of their power-of-two bucket, so within
+// 2x of the real value.
+struct LatencySnapshot {
+  uint64_t count = 0;
+  uint64_t p50_ns = 0;
+  uint64_t p90_ns = 0;
+  uint64_t p99_ns = 0;
+  uint64_t max_ns = 0;
+};
+
+#ifdef ONED_METRICS
+
+inline constexpr bool kMetricsEnabled = true;
+
+// Relaxed, a hot path pays one uncontended atomic add.
+class Counter {
+public:
+  void add(uint64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t load() const {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> value_{0};
+};
+
+// Latencies counted in power-of-two buckets of nanoseconds.
+class LatencyHistogram {
+public:
+  void record(std::chrono::nanoseconds elapsed) {
+    auto ns = static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0));
+    buckets_[std::bit_width(ns)].fetch_add(1, std::memory_order_relaxed);
+    auto max = max_.load(std::memory_order_relaxed);
+    while (ns > max &&
+           !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  LatencySnapshot snapshot() const {
+    std::array<uint64_t, kBuckets> counts{};
+    LatencySnapshot ret{.max_ns = max_.load(std::memory_order_relaxed)};
+    for (std::size_t i = 0; i < kBuckets; i++) {
+      counts[i] = buckets_[i].load(std::memory_order_relaxed);
+      ret.count += counts[i];
+    }
+    auto percentile = [&](uint64_t per_mille) {
+      uint64_t seen = 0;
+      for (std::size_t i = 0; i < kBuckets; i++) {
+        seen += counts[i];
+        if (seen * 1000 >= ret.count * per_mille) {
+          return i < 64 ? std::min((uint64_t(1) << i) - 1, ret.max_ns)
+                        : ret.max_ns;
+        }
+      }
+      return ret.max_ns;
+    };
+    if (ret.count != 0) {
+      ret.p50_ns = percentile(500);
+      ret.p90_ns = percentile(900);
+      ret.p99_ns = percentile(990);
+    }
+    return ret;
+  }
+
+private:
+  // bucket i holds latencies of bit width i
+  static constexpr std::size_t kBuckets = 65;
+
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> max_{0};
+};
+
+// Records the time from construction to destruction.
+class ScopedLatency : NonCopyable {
+public:
+  explicit ScopedLatency(LatencyHistogram &histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+  ScopedLatency(ScopedLatency &&) = delete;
+  ScopedLatency &operator=(ScopedLatency &&) = delete;
+
+  ~ScopedLatency() {
+    histogram_.record(std::chrono::steady_clock::now() - start_);
+  }
+
+private:
+  LatencyHistogram &histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#else
+
+// Built without ONED_METRICS: empty, every call compiles to nothing.
+inline constexpr bool kMetricsEnabled = false;
+
+class Counter {
+public:
+  void add(uint64_t /*n*/ = 1) {}
+
+  uint64_t load() const {
+    return 0;
+  }
+};
+
+class LatencyHistogram {
+public:
+  void record(std::chrono::nanoseconds /*elapsed*/) {}
+
+  LatencySnapshot snapshot() const {
+    return {};
+  }
+};
+
+class ScopedLatency : NonCopyable {
+public:
+  explicit ScopedLatency(LatencyHistogram & /*histogram*/) {}
+
+  ScopedLatency(ScopedLatency &&) = delete;
+  ScopedLatency &operator=(ScopedLatency &&) = delete;
+  ~ScopedLatency() = default;
+};
+
+#endif
+
+// Calls `dump` every `interval` on a thread of its own until destroyed,
+// e.g. with [&] { INFOF("{}", mgr.metrics()); }.
+class MetricsReporter : NonCopyable {
+public:
+  MetricsReporter(std::chrono::milliseconds interval,
+                  std::function<void()> dump);
+
+  MetricsReporter(MetricsReporter &&) = delete;
+  MetricsReporter &operator=(MetricsReporter &&) = delete;
+  ~MetricsReporter();
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace oned
+
+template <>
+struct fmt::formatter<oned::LatencySnapshot>
+    : fmt::formatter<std::string_view> {
+  template <typename FormatContext>
+  auto format(const oned::LatencySnapshot &s, FormatContext &ctx) const
+      -> decltype(ctx.out()) {
+    return fmt::format_to(ctx.out(), "n={} p50={}ns p90={}ns p99={}ns max={}ns",
+                          s.count, s.p50_ns, s.p90_ns, s.p99_ns, s.max_ns);
+  }
+};
@@ -0,0 +1,44 @@
+#include "metrics.hh"
+
+#include <gtest/gtest.h>
+
+using namespace oned;
+using namespace std::chrono_literals;
+
+TEST(LatencyHistogram, percentiles) {
+  if (!kMetricsEnabled) {
+    GTEST_SKIP() << "built without ONED_METRICS";
+  }
+  LatencyHistogram histogram;
+  ASSERT_EQ(histogram.snapshot().count, 0);
+  for (int i = 0; i < 90; i++) {
+    histogram.record(100ns);
+  }
+  for (int i = 0; i < 9; i++) {
+    histogram.record(10us);
+  }
+  histogram.record(1ms);
+  histogram.record(-1ns);
+
+  // bucket bounds within 2x, never above the max
+  auto s = histogram.snapshot();
+  EXPECT_EQ(s.count, 101);
+  EXPECT_GE(s.p50_ns, 100);
+  EXPECT_LT(s.p50_ns, 200);
+  EXPECT_GE(s.p99_ns, 10'000);
+  EXPECT_LT(s.p99_ns, 20'000);
+  EXPECT_EQ(s.max_ns, 1'000'000);
+}
+
+TEST(MetricsReporter, dumps_until_destroyed) {
+  std::atomic<int> dumps{0};
+  {
+    MetricsReporter reporter(1ms, [&] { dumps++; });
+    while (dumps < 3) {
+      std::this_thread::sleep_for(1ms);
+    }
+  }
+  auto after = dumps.load();
+  std::this_thread::sleep_for(5ms);
+  EXPECT_EQ(dumps.load(), after);
+}
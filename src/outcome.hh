@@ -6,6 +6,7 @@
 #include <outcome.hpp>
 
 #include <source_location>
+#include <tuple>
 
 #define TRY(...) OUTCOME_TRY(__VA_ARGS__)
 #define TRYV(...) OUTCOME_TRYV(__VA_ARGS__)
@@ -850,3 +851,55 @@ struct quick_status_code_from_enum<oned::GenericErrc>
   }
 };
 SYSTEM_ERROR2_NAMESPACE_END
+
+namespace oned {
+
+// A make_error payload that keeps the format string and copies of the
+// arguments, formatting only when the message is asked for. Cheaper for
+// errors that are mostly dropped, e.g. reads past EOF during read-ahead:
+//
+//   make_error(GenericErrc::io_error, lazy_format("EOF at {}", offset))
+template <typename... Args>
+class LazyFormat {
+  static_assert(((std::is_arithmetic_v<Args> || std::is_enum_v<Args>)&&...),
+                "arguments outlive the call, views would dangle");
+
+public:
+  explicit LazyFormat(fmt::format_string<Args...> spec, Args... args)
+      : spec_(spec), args_(args...) {}
+
+  std::string_view spec() const {
+    return {spec_.data(), spec_.size()};
+  }
+
+  const std::tuple<Args...> &args() const {
+    return args_;
+  }
+
+private:
+  // a literal, checked against Args at compile time
+  fmt::string_view spec_;
+  std::tuple<Args...> args_;
+};
+
+template <typename... Args>
+LazyFormat<std::decay_t<Args>...> lazy_format(
+    fmt::format_string<std::decay_t<Args>...> spec, Args &&...args) {
+  return LazyFormat<std::decay_t<Args>...>(spec, args...);
+}
+
+}  // namespace oned
+
+template <typename... Args>
+struct fmt::formatter<oned::LazyFormat<Args...>>
+    : fmt::formatter<std::string_view> {
+  template <typename FormatContext>
+  auto format(const oned::LazyFormat<Args...> &f, FormatContext &ctx) const
+      -> decltype(ctx.out()) {
+    return std::apply(
+        [&](const auto &...args) {
+          return fmt::format_to(ctx.out(), fmt::runtime(f.spec()), args...);
+        },
+        f.args());
+  }
+};
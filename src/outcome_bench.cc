@@ -0,0 +1,65 @@
+#include "outcome.hh"
+
+#include <benchmark/benchmark.h>
+
+using namespace oned;
+
+enum class Failure { none, bare, formatted, lazy };
+
+// A read at `offset` of a file of `size` bytes, failing past EOF the way
+// selected.
+[[gnu::noinline]] static Result<uint64_t> read_at(uint64_t offset,
+                                                  uint64_t size,
+                                                  Failure failure) {
+  if (offset < size || failure == Failure::none) {
+    return offset;
+  }
+  if (failure == Failure::bare) {
+    return GenericErrc::io_error;
+  }
+  if (failure == Failure::formatted) {
+    return make_error(GenericErrc::io_error,
+                      fmt::format("unexpected EOF when reading at {}~{}",
+                                  offset, size));
+  }
+  return make_error(GenericErrc::io_error,
+                    lazy_format("unexpected EOF when reading at {}~{}",
+                                offset, size));
+}
+
+// Two frames of TRYX on the way up, as from a loader through ChunkManager.
+[[gnu::noinline]] static Result<uint64_t> load(uint64_t offset, uint64_t size,
+                                               Failure failure) {
+  return TRYX(read_at(offset, size, failure)) + 1;
+}
+
+[[gnu::noinline]] static Result<uint64_t> prefetch(uint64_t offset,
+                                                   uint64_t size,
+                                                   Failure failure) {
+  return TRYX(load(offset, size, failure)) + 1;
+}
+
+static void BM_Tryx(benchmark::State &state, Failure failure) {
+  // past EOF unless measuring success
+  uint64_t size = failure == Failure::none ? UINT64_MAX : 0;
+  uint64_t offset = 1 << 20;
+  for (auto _ : state) {
+    auto ret = prefetch(offset, size, failure);
+    benchmark::DoNotOptimize(ret);
+    benchmark::DoNotOptimize(offset);
+  }
+}
+
+// The message of a lazy error is formatted when printed.
+static void BM_TryxLazyMessage(benchmark::State &state) {
+  for (auto _ : state) {
+    auto ret = prefetch(1 << 20, 0, Failure::lazy);
+    benchmark::DoNotOptimize(fmt::format("{}", ret.error()));
+  }
+}
+
+BENCHMARK_CAPTURE(BM_Tryx, success, Failure::none);
+BENCHMARK_CAPTURE(BM_Tryx, bare_errc, Failure::bare);
+BENCHMARK_CAPTURE(BM_Tryx, formatted_payload, Failure::formatted);
+BENCHMARK_CAPTURE(BM_Tryx, lazy_payload, Failure::lazy);
+BENCHMARK(BM_TryxLazyMessage);
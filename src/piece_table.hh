@@ -1,8 +1,15 @@
 #pragma once
 
+#include "noncopyable.hh"
+#include "weighted_tree.hh"
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -13,20 +20,58 @@ class PieceTableTest;
 namespace oned {
 
 class PieceTable {
+  struct Piece;
+  struct PieceLength;
+  using Pieces = WeightedTree<Piece, PieceLength>;
+
 public:
   static constexpr uint64_t kDefaultChunkSize = 64;
+  static constexpr uint64_t kDefaultHistoryLimit = 64 << 20;
+
+  // The text as of one edit. Taking one is O(1) and shares the pieces
+  // with the table, it stays valid and unchanged however the table is
+  // edited later, and may be read on any thread. Not copyable, readers
+  // share one through a shared_ptr<const Snapshot>.
+  class Snapshot {
+  public:
+    uint64_t size() const {
+      return pieces_.weight();
+    }
+
+    // edits of the table before this snapshot, to tell two apart
+    uint64_t version() const {
+      return version_;
+    }
+
+    std::string dump() const {
+      return read_pieces(pieces_, 0, size());
+    }
+
+    std::string read(uint64_t offset, uint64_t length) const {
+      return read_pieces(pieces_, offset, length);
+    }
+
+  private:
+    friend class PieceTable;
+
+    Snapshot(Pieces pieces, uint64_t version)
+        : pieces_(std::move(pieces)), version_(version) {}
+
+    Pieces pieces_;
+    uint64_t version_;
+  };
 
   explicit PieceTable(uint64_t chunk_size = kDefaultChunkSize)
       : chunk_size_(chunk_size),
-        pending_chunk_(std::make_shared<std::string>()) {
-    pending_chunk_->reserve(chunk_size);
-  }
+        pending_chunk_(std::make_shared<Chunk>(chunk_size)) {}
 
   explicit PieceTable(std::string_view str,
                       uint64_t chunk_size = kDefaultChunkSize)
       : chunk_size_(chunk_size),
-        pending_chunk_(std::make_shared<std::string>()),
-        pieces_(append_string(str)) {}
+        pending_chunk_(std::make_shared<Chunk>(chunk_size)) {
+    auto ps = append_string(str);
+    pieces_.insert(pieces_.end(), ps.begin(), ps.end());
+  }
 
   PieceTable(const PieceTable &other) = delete;
   PieceTable(PieceTable &&other) noexcept = default;
@@ -35,35 +80,123 @@ public:
   ~PieceTable() = default;
 
   void insert(uint64_t offset, std::string_view str) {
-    auto iter = maybe_split_at(offset);
     auto ps = append_string(str);
-    pieces_.insert(iter, ps.begin(), ps.end());
+    splice(offset, 0, ps);
+    record(offset, {}, std::move(ps));
   }
 
   void remove(uint64_t offset, uint64_t length) {
-    maybe_split_at(offset);
-    auto iter = maybe_split_at(offset + length);
-    auto res = find_piece(offset);
-    assert(res.first == offset);
-    pieces_.erase(res.second, iter);
+    record(offset, splice(offset, length, {}), {});
   }
 
-  std::string dump() const {
-    std::string ret;
-    for (auto &piece : pieces_) {
-      ret.append(piece.chunk_->substr(piece.offset_, piece.length_));
+  // Edits until the matching end_transaction() are undone and redone as
+  // one. Transactions nest, only the outermost counts.
+  void begin_transaction() {
+    open_transactions_++;
+  }
+
+  void end_transaction() {
+    assert(open_transactions_ > 0);
+    if (--open_transactions_ == 0) {
+      transaction_started_ = false;
     }
-    return ret;
+  }
+
+  // Revert the last transaction, false when there is none. O(log n) per
+  // piece it touched, the text is never copied.
+  bool undo() {
+    if (undo_.empty()) {
+      return false;
+    }
+    transaction_started_ = false;
+    auto &t = undo_.back();
+    for (auto iter = t.edits_.rbegin(); iter != t.edits_.rend(); iter++) {
+      splice(iter->offset_, length_of(iter->inserted_), iter->removed_);
+    }
+    redo_.push_back(std::move(t));
+    undo_.pop_back();
+    return true;
+  }
+
+  // Reapply the last undone transaction, until the next edit.
+  bool redo() {
+    if (redo_.empty()) {
+      return false;
+    }
+    auto &t = redo_.back();
+    for (auto &edit : t.edits_) {
+      splice(edit.offset_, length_of(edit.removed_), edit.inserted_);
+    }
+    undo_.push_back(std::move(t));
+    redo_.pop_back();
+    return true;
+  }
+
+  // Once the history accounts for more than `bytes`, what is left to redo
+  // goes first, the transaction redo() would reach last first, then the
+  // oldest undo transactions. The latest one is always kept.
+  void set_history_limit(uint64_t bytes) {
+    history_limit_ = bytes;
+    trim_history();
+  }
+
+  // text the undo and redo history refers to, plus bookkeeping
+  uint64_t history_bytes() const {
+    return history_bytes_;
+  }
+
+  uint64_t size() const {
+    return pieces_.weight();
+  }
+
+  uint64_t version() const {
+    return version_;
+  }
+
+  std::string dump() const {
+    return read_pieces(pieces_, 0, size());
+  }
+
+  // Not const, the next edit has to copy the nodes it shares.
+  Snapshot snapshot() {
+    return Snapshot(pieces_.share(), version_);
   }
 
 private:
-  using Chunk = std::shared_ptr<std::string>;
+  // Append-only and never reallocated, so the bytes a snapshot refers to
+  // stay in place while the table appends behind them on another thread.
+  struct Chunk {
+    explicit Chunk(uint64_t capacity)
+        : data_(new char[capacity]), capacity_(capacity) {}
+
+    std::string_view view() const {
+      return {data_.get(), size_.load(std::memory_order_acquire)};
+    }
+
+    uint64_t size() const {
+      return size_.load(std::memory_order_relaxed);
+    }
+
+    void append(std::string_view str) {
+      auto size = size_.load(std::memory_order_relaxed);
+      assert(size + str.size() <= capacity_);
+      std::copy(str.begin(), str.end(), data_.get() + size);
+      size_.store(size + str.size(), std::memory_order_release);
+    }
+
+    std::unique_ptr<char[]> data_;
+    uint64_t capacity_;
+    // only the table writes, readers never look past the pieces they hold
+    std::atomic<uint64_t> size_{0};
+  };
+  using ChunkPtr = std::shared_ptr<Chunk>;
+
   struct Piece {
     uint64_t offset_{};
     uint64_t length_{};
-    Chunk chunk_;
+    ChunkPtr chunk_;
 
-    std::pair<Piece, Piece> split(uint64_t pivot) {
+    std::pair<Piece, Piece> split(uint64_t pivot) const {
       assert(pivot > 0);
       assert(pivot < length_);
       auto left = Piece{
@@ -82,6 +215,100 @@ private:
     std::strong_ordering operator<=>(const Piece &other) const = default;
   };
 
+  struct PieceLength {
+    uint64_t operator()(const Piece &piece) const {
+      return piece.length_;
+    }
+  };
+
+  // One insert or remove, by the pieces it took out and put in. The
+  // pieces share the append-only chunks, so no text is copied.
+  struct Edit {
+    uint64_t offset_{};
+    std::vector<Piece> removed_;
+    std::vector<Piece> inserted_;
+  };
+
+  struct Transaction {
+    std::vector<Edit> edits_;
+    uint64_t bytes_ = 0;
+  };
+
+  static uint64_t length_of(const std::vector<Piece> &ps) {
+    uint64_t ret = 0;
+    for (auto &piece : ps) {
+      ret += piece.length_;
+    }
+    return ret;
+  }
+
+  // Replace `length` bytes at `offset` by `ps`, returning the pieces that
+  // were there.
+  std::vector<Piece> splice(uint64_t offset, uint64_t length,
+                            const std::vector<Piece> &ps) {
+    maybe_split_at(offset);
+    auto last = maybe_split_at(offset + length);
+    auto res = find_piece(offset);
+    assert(res.first == offset);
+    std::vector<Piece> removed(res.second, last);
+    auto iter = pieces_.erase(res.second, last);
+    pieces_.insert(iter, ps.begin(), ps.end());
+    version_++;
+    return removed;
+  }
+
+  void record(uint64_t offset, std::vector<Piece> removed,
+              std::vector<Piece> inserted) {
+    if (removed.empty() && inserted.empty()) {
+      return;
+    }
+    for (auto &t : redo_) {
+      history_bytes_ -= t.bytes_;
+    }
+    redo_.clear();
+    if (!transaction_started_) {
+      undo_.emplace_back();
+      transaction_started_ = open_transactions_ > 0;
+    }
+    auto bytes = sizeof(Edit) +
+                 (removed.size() + inserted.size()) * sizeof(Piece) +
+                 length_of(removed) + length_of(inserted);
+    auto &t = undo_.back();
+    t.edits_.push_back(Edit{
+        .offset_ = offset,
+        .removed_ = std::move(removed),
+        .inserted_ = std::move(inserted),
+    });
+    t.bytes_ += bytes;
+    history_bytes_ += bytes;
+    trim_history();
+  }
+
+  void trim_history() {
+    while (history_bytes_ > history_limit_ && !redo_.empty()) {
+      history_bytes_ -= redo_.front().bytes_;
+      redo_.pop_front();
+    }
+    while (history_bytes_ > history_limit_ && undo_.size() > 1) {
+      history_bytes_ -= undo_.front().bytes_;
+      undo_.pop_front();
+    }
+  }
+
+  static std::string read_pieces(const Pieces &pieces, uint64_t offset,
+                                 uint64_t length) {
+    std::string ret;
+    ret.reserve(length);
+    auto [start, iter] = pieces.find(offset);
+    for (; iter != pieces.end() && ret.size() < length; ++iter) {
+      auto skip = offset > start ? offset - start : 0;
+      auto n = std::min(iter->length_ - skip, length - ret.size());
+      ret.append(iter->chunk_->data_.get() + iter->offset_ + skip, n);
+      start += iter->length_;
+    }
+    return ret;
+  }
+
   std::vector<Piece> append_string(std::string_view str) {
     if (str.empty()) {
       return {};
@@ -93,8 +320,7 @@ private:
     std::vector<Piece> ps;
     for (auto i = pending_size / chunk_size_; i < count; i++) {
       if (pending_chunk_->size() == chunk_size_) {
-        pending_chunk_ = std::make_shared<std::string>();
-        pending_chunk_->reserve(chunk_size_);
+        pending_chunk_ = std::make_shared<Chunk>(chunk_size_);
       }
       auto rest_str_len = str.size() - str_cursor;
       auto rest_chunk_len = chunk_size_ - pending_chunk_->size();
@@ -107,7 +333,7 @@ private:
     return ps;
   }
 
-  auto maybe_split_at(uint64_t offset) -> std::vector<Piece>::iterator {
+  auto maybe_split_at(uint64_t offset) -> Pieces::iterator {
     auto [piece_start, iter] = find_piece(offset);
     if (iter == pieces_.end() || piece_start == offset) {
       return iter;
@@ -125,28 +351,54 @@ private:
     auto [left_piece, right_piece] = iter->split(offset - piece_start);
     assert(offset == piece_start + left_piece.length_);
     // remap original piece to right, then insert left before right
-    *iter = right_piece;
+    pieces_.replace(iter, right_piece);
     iter = pieces_.insert(iter, left_piece);
     // return the right piece
     return ++iter;
   }
 
-  auto find_piece(uint64_t offset)
-      -> std::pair<uint64_t, std::vector<Piece>::iterator> {
-    auto piece_start = 0UL;
-    for (auto iter = pieces_.begin(); iter != pieces_.end(); iter++) {
-      if (piece_start + iter->length_ > offset) {
-        return std::make_pair(piece_start, iter);
-      }
-      piece_start += iter->length_;
-    }
-    return std::make_pair(piece_start, pieces_.end());
+  auto find_piece(uint64_t offset) -> std::pair<uint64_t, Pieces::iterator> {
+    return pieces_.find(offset);
   }
 
   uint64_t chunk_size_;
-  Chunk pending_chunk_;
-  std::vector<Piece> pieces_;
+  ChunkPtr pending_chunk_;
+  Pieces pieces_;
+  uint64_t version_ = 0;
+
+  std::deque<Transaction> undo_;
+  std::deque<Transaction> redo_;
+  uint64_t history_bytes_ = 0;
+  uint64_t history_limit_ = kDefaultHistoryLimit;
+  int open_transactions_ = 0;
+  // the open transaction has an entry in undo_
+  bool transaction_started_ = false;
 
   friend class ::PieceTableTest;
 };
+
+// Hands the latest snapshot of a table from its writer to readers on
+// other threads. A reader keeps what it loaded for as long as it likes,
+// only the exchange of the pointer is locked. (libstdc++'s
+// atomic<shared_ptr> takes a spinlock all the same, and TSan can't see
+// through it.)
+class SnapshotSlot : NonCopyable {
+public:
+  void store(PieceTable::Snapshot snapshot) {
+    auto next =
+        std::make_shared<const PieceTable::Snapshot>(std::move(snapshot));
+    std::lock_guard lock(mutex_);
+    latest_.swap(next);
+  }
+
+  // null before the first store
+  std::shared_ptr<const PieceTable::Snapshot> load() const {
+    std::lock_guard lock(mutex_);
+    return latest_;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::shared_ptr<const PieceTable::Snapshot> latest_;
+};
 }  // namespace oned
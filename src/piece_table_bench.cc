@@ -0,0 +1,102 @@
+#include "piece_table.hh"
+
+#include <benchmark/benchmark.h>
+#include <random>
+
+using oned::PieceTable;
+
+static constexpr int64_t kEdits = 1'000'000;
+
+// Random small inserts into a buffer of `state.range(0)` bytes.
+static void BM_PieceTableInsert(benchmark::State &state) {
+  auto table = PieceTable(std::string(state.range(0), 'x'));
+  std::mt19937_64 rng(42);
+  for (auto _ : state) {
+    auto offset = rng() % (table.size() + 1);
+    table.insert(offset, "hello");
+  }
+}
+BENCHMARK(BM_PieceTableInsert)
+    ->Arg(1 << 20)
+    ->Arg(64 << 20)
+    ->Iterations(kEdits)
+    ->Unit(benchmark::kNanosecond);
+
+// Interleaved inserts and removes, keeping the buffer size roughly stable.
+static void BM_PieceTableEdit(benchmark::State &state) {
+  auto table = PieceTable(std::string(state.range(0), 'x'));
+  std::mt19937_64 rng(42);
+  for (auto _ : state) {
+    auto offset = rng() % (table.size() + 1);
+    if (rng() & 1) {
+      table.insert(offset, "hello");
+    } else {
+      table.remove(offset, std::min<uint64_t>(5, table.size() - offset));
+    }
+  }
+}
+BENCHMARK(BM_PieceTableEdit)
+    ->Arg(1 << 20)
+    ->Arg(64 << 20)
+    ->Iterations(kEdits)
+    ->Unit(benchmark::kNanosecond);
+
+// The same with a snapshot taken after every edit, as for a renderer, so
+// each edit copies its path.
+static void BM_PieceTableEditSnapshots(benchmark::State &state) {
+  auto table = PieceTable(std::string(state.range(0), 'x'));
+  auto snapshot = table.snapshot();
+  std::mt19937_64 rng(42);
+  for (auto _ : state) {
+    auto offset = rng() % (table.size() + 1);
+    if (rng() & 1) {
+      table.insert(offset, "hello");
+    } else {
+      table.remove(offset, std::min<uint64_t>(5, table.size() - offset));
+    }
+    snapshot = table.snapshot();
+  }
+  benchmark::DoNotOptimize(snapshot.size());
+}
+BENCHMARK(BM_PieceTableEditSnapshots)
+    ->Arg(1 << 20)
+    ->Arg(64 << 20)
+    ->Iterations(kEdits)
+    ->Unit(benchmark::kNanosecond);
+
+// Undo and redo of one edit in a buffer of `state.range(0)` bytes split up
+// by 100k edits.
+static void BM_PieceTableUndoRedo(benchmark::State &state) {
+  auto table = PieceTable(std::string(state.range(0), 'x'));
+  std::mt19937_64 rng(42);
+  for (int i = 0; i < 100'000; i++) {
+    auto offset = rng() % (table.size() + 1);
+    table.insert(offset, "hello");
+  }
+  for (auto _ : state) {
+    table.undo();
+    table.redo();
+  }
+}
+BENCHMARK(BM_PieceTableUndoRedo)
+    ->Arg(1 << 20)
+    ->Arg(64 << 20)
+    ->Unit(benchmark::kNanosecond);
+
+// Materialize a buffer of `state.range(0)` bytes split up by 100k edits.
+static void BM_PieceTableDump(benchmark::State &state) {
+  auto table = PieceTable(std::string(state.range(0), 'x'));
+  std::mt19937_64 rng(42);
+  for (int i = 0; i < 100'000; i++) {
+    auto offset = rng() % (table.size() + 1);
+    table.insert(offset, "hello");
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.dump());
+  }
+  state.SetBytesProcessed(int64_t(state.iterations() * table.size()));
+}
+BENCHMARK(BM_PieceTableDump)
+    ->Arg(1 << 20)
+    ->Arg(64 << 20)
+    ->Unit(benchmark::kMillisecond);
@@ -2,6 +2,8 @@
 
 #include <gtest/gtest.h>
 #include <random>
+#include <thread>
+#include <type_traits>
 
 using oned::PieceTable;
 
@@ -9,8 +11,10 @@ class PieceTableTest : public ::testing::Test {
 protected:
   void SetUp() override {
     table = std::make_unique<oned::PieceTable>(8);
-    auto c0 = std::make_shared<std::string>("00001111");
-    auto c1 = std::make_shared<std::string>("2222");
+    auto c0 = std::make_shared<oned::PieceTable::Chunk>(8);
+    c0->append("00001111");
+    auto c1 = std::make_shared<oned::PieceTable::Chunk>(8);
+    c1->append("2222");
     table->pending_chunk_ = c1;
 
     auto &pieces = table->pieces_;
@@ -103,10 +107,10 @@ protected:
     auto [left, right] = piece0.split(2);
     EXPECT_EQ(left.offset_, 0);
     EXPECT_EQ(left.length_, 2);
-    EXPECT_EQ(*left.chunk_, "00001111");
+    EXPECT_EQ(left.chunk_->view(), "00001111");
     EXPECT_EQ(right.offset_, 2);
     EXPECT_EQ(right.length_, 2);
-    EXPECT_EQ(*right.chunk_, "00001111");
+    EXPECT_EQ(right.chunk_->view(), "00001111");
   }
 
   void test_maybe_split_at() {
@@ -116,25 +120,25 @@ protected:
     EXPECT_EQ(table->pieces_.size(), 4);
     EXPECT_EQ(table->pieces_[0].offset_, 0);
     EXPECT_EQ(table->pieces_[0].length_, 2);
-    EXPECT_EQ(*table->pieces_[0].chunk_, "00001111");
+    EXPECT_EQ(table->pieces_[0].chunk_->view(), "00001111");
     EXPECT_EQ(table->pieces_[1], *iter);
   }
 
   void test_insert() {
     table->insert(4, "xxxx");
-    EXPECT_EQ(*table->pending_chunk_, "2222xxxx");
+    EXPECT_EQ(table->pending_chunk_->view(), "2222xxxx");
     EXPECT_EQ(table->pieces_.size(), 4);
     EXPECT_EQ(table->pieces_[1].offset_, 4);
     EXPECT_EQ(table->pieces_[1].length_, 4);
-    EXPECT_EQ(*table->pieces_[1].chunk_, *table->pending_chunk_);
+    EXPECT_EQ(table->pieces_[1].chunk_, table->pending_chunk_);
     EXPECT_EQ(table->dump(), "0000xxxx11112222");
 
     table->insert(16, "yyyy");
-    EXPECT_EQ(*table->pending_chunk_, "yyyy");
+    EXPECT_EQ(table->pending_chunk_->view(), "yyyy");
     EXPECT_EQ(table->pieces_.size(), 5);
     EXPECT_EQ(table->pieces_[4].offset_, 0);
     EXPECT_EQ(table->pieces_[4].length_, 4);
-    EXPECT_EQ(*table->pieces_[4].chunk_, "yyyy");
+    EXPECT_EQ(table->pieces_[4].chunk_->view(), "yyyy");
     EXPECT_EQ(table->dump(), "0000xxxx11112222yyyy");
 
     table->insert(18, "zzzz");
@@ -149,23 +153,23 @@ protected:
     EXPECT_EQ(table->pieces_.size(), 2);
     EXPECT_EQ(table->pieces_[0].offset_, 4);
     EXPECT_EQ(table->pieces_[0].length_, 4);
-    EXPECT_EQ(*table->pieces_[0].chunk_, "00001111");
+    EXPECT_EQ(table->pieces_[0].chunk_->view(), "00001111");
     EXPECT_EQ(table->pieces_[1].offset_, 0);
     EXPECT_EQ(table->pieces_[1].length_, 4);
-    EXPECT_EQ(*table->pieces_[1].chunk_, "2222");
+    EXPECT_EQ(table->pieces_[1].chunk_->view(), "2222");
     EXPECT_EQ(table->dump(), "11112222");
 
     table->remove(1, 2);
     EXPECT_EQ(table->pieces_.size(), 3);
     EXPECT_EQ(table->pieces_[0].offset_, 4);
     EXPECT_EQ(table->pieces_[0].length_, 1);
-    EXPECT_EQ(*table->pieces_[0].chunk_, "00001111");
+    EXPECT_EQ(table->pieces_[0].chunk_->view(), "00001111");
     EXPECT_EQ(table->pieces_[1].offset_, 7);
     EXPECT_EQ(table->pieces_[1].length_, 1);
-    EXPECT_EQ(*table->pieces_[1].chunk_, "00001111");
+    EXPECT_EQ(table->pieces_[1].chunk_->view(), "00001111");
     EXPECT_EQ(table->pieces_[2].offset_, 0);
     EXPECT_EQ(table->pieces_[2].length_, 4);
-    EXPECT_EQ(*table->pieces_[2].chunk_, "2222");
+    EXPECT_EQ(table->pieces_[2].chunk_->view(), "2222");
     EXPECT_EQ(table->dump(), "112222");
 
     table->remove(0, 6);
@@ -239,3 +243,175 @@ TEST_F(PieceTableTest, Remove) {
 TEST_F(PieceTableTest, Fuzzy) {
   test_fuzzy();
 }
+
+// a copy would have to write to the shared source
+static_assert(!std::is_copy_constructible_v<PieceTable::Snapshot>);
+
+TEST(PieceTableSnapshot, unchanged_by_later_edits) {
+  auto table = PieceTable("hello world", 4);
+  auto before = table.snapshot();
+  table.insert(5, ",");
+  table.remove(0, 1);
+  table.insert(table.size(), "!");
+  auto after = table.snapshot();
+
+  EXPECT_EQ(before.dump(), "hello world");
+  EXPECT_EQ(before.version(), 0);
+  EXPECT_EQ(before.read(3, 5), "lo wo");
+  EXPECT_EQ(after.dump(), "ello, world!");
+  EXPECT_EQ(after.version(), 3);
+  EXPECT_EQ(after.read(10, 10), "d!");
+  EXPECT_EQ(after.read(20, 1), "");
+  EXPECT_EQ(table.dump(), after.dump());
+}
+
+TEST(PieceTableSnapshot, concurrent_readers) {
+  auto table = PieceTable(std::string(1000, 'x'), 16);
+  oned::SnapshotSlot slot;
+  slot.store(table.snapshot());
+  std::atomic<bool> done{false};
+
+  // every snapshot a reader sees is whole, some 'x' plus `version` "ab"
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&] {
+      while (!done.load()) {
+        auto snapshot = slot.load();
+        auto text = snapshot->dump();
+        ASSERT_EQ(text.size(), 1000 + 2 * snapshot->version());
+        ASSERT_EQ(std::count(text.begin(), text.end(), 'a'),
+                  snapshot->version());
+      }
+    });
+  }
+  std::mt19937 rng(42);
+  for (int i = 0; i < 2000; i++) {
+    table.insert(rng() % (table.size() + 1), "ab");
+    slot.store(table.snapshot());
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(slot.load()->version(), 2000);
+}
+
+TEST(PieceTableHistory, undo_redo) {
+  auto table = PieceTable("hello world", 4);
+  table.insert(5, ",");
+  table.remove(0, 1);
+  EXPECT_EQ(table.dump(), "ello, world");
+
+  EXPECT_TRUE(table.undo());
+  EXPECT_EQ(table.dump(), "hello, world");
+  EXPECT_TRUE(table.undo());
+  EXPECT_EQ(table.dump(), "hello world");
+  EXPECT_FALSE(table.undo());
+
+  EXPECT_TRUE(table.redo());
+  EXPECT_EQ(table.dump(), "hello, world");
+
+  // a new edit drops what is left to redo
+  table.insert(table.size(), "!");
+  EXPECT_FALSE(table.redo());
+  EXPECT_EQ(table.dump(), "hello, world!");
+  EXPECT_TRUE(table.undo());
+  EXPECT_TRUE(table.undo());
+  EXPECT_EQ(table.dump(), "hello world");
+}
+
+TEST(PieceTableHistory, transactions) {
+  auto table = PieceTable("abc");
+  table.begin_transaction();
+  table.insert(0, "1");
+  table.begin_transaction();
+  table.remove(1, 1);
+  table.end_transaction();
+  table.insert(table.size(), "2");
+  table.end_transaction();
+  table.insert(0, "x");
+  EXPECT_EQ(table.dump(), "x1bc2");
+
+  EXPECT_TRUE(table.undo());
+  EXPECT_EQ(table.dump(), "1bc2");
+  EXPECT_TRUE(table.undo());
+  EXPECT_EQ(table.dump(), "abc");
+  EXPECT_TRUE(table.redo());
+  EXPECT_EQ(table.dump(), "1bc2");
+}
+
+TEST(PieceTableHistory, limit) {
+  auto table = PieceTable();
+  table.set_history_limit(4096);
+  for (int i = 0; i < 1000; i++) {
+    table.insert(table.size(), "0123456789");
+  }
+  EXPECT_LE(table.history_bytes(), 4096);
+  int undone = 0;
+  while (table.undo()) {
+    undone++;
+  }
+  EXPECT_GT(undone, 0);
+  EXPECT_LT(undone, 1000);
+  EXPECT_EQ(table.size(), (1000 - undone) * 10);
+
+  // redo goes before undo, the transactions redo() reaches last first.
+  // Every insert fills one chunk, so they all account for the same bytes.
+  table = PieceTable();
+  for (int i = 0; i < 10; i++) {
+    table.insert(table.size(),
+                 std::string(PieceTable::kDefaultChunkSize, char('a' + i)));
+  }
+  for (int i = 0; i < 5; i++) {
+    ASSERT_TRUE(table.undo());
+  }
+  auto per_edit = table.history_bytes() / 10;
+  table.set_history_limit(per_edit * 7);
+  EXPECT_LE(table.history_bytes(), per_edit * 7);
+  ASSERT_TRUE(table.redo());
+  ASSERT_TRUE(table.redo());
+  EXPECT_FALSE(table.redo());
+  EXPECT_EQ(table.size(), 7 * PieceTable::kDefaultChunkSize);
+  EXPECT_EQ(table.dump().back(), 'g');
+  int left = 0;
+  while (table.undo()) {
+    left++;
+  }
+  EXPECT_EQ(left, 7);
+  EXPECT_EQ(table.size(), 0);
+
+  // and may go entirely, but the latest undo transaction is kept
+  ASSERT_TRUE(table.redo());
+  ASSERT_TRUE(table.redo());
+  table.set_history_limit(0);
+  EXPECT_FALSE(table.redo());
+  EXPECT_TRUE(table.undo());
+  EXPECT_FALSE(table.undo());
+}
+
+TEST(PieceTableHistory, fuzzy) {
+  auto table = PieceTable(8);
+  std::vector<std::string> versions{""};
+  std::mt19937 rng(42);
+  // edits of length 0 leave no history
+  for (int i = 0; i < 2000; i++) {
+    auto offset = rng() % (table.size() + 1);
+    uint64_t length = 1 + rng() % 20;
+    if (rng() % 2 == 0 || offset == table.size()) {
+      table.insert(offset, std::string(length, char('a' + i % 26)));
+    } else {
+      table.remove(offset, std::min(length, table.size() - offset));
+    }
+    versions.push_back(table.dump());
+  }
+  auto before = table.snapshot();
+  for (auto i = versions.size() - 1; i-- > 0;) {
+    ASSERT_TRUE(table.undo());
+    ASSERT_EQ(table.dump(), versions[i]);
+  }
+  for (std::size_t i = 1; i < versions.size(); i++) {
+    ASSERT_TRUE(table.redo());
+    ASSERT_EQ(table.dump(), versions[i]);
+  }
+  EXPECT_EQ(before.dump(), versions.back());
+}
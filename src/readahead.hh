@@ -0,0 +1,99 @@
+#pragma once
+
+#include "chunk.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace oned {
+
+struct ReadaheadRequest {
+  ChunkID start_ = 0;
+  uint32_t count_ = 0;
+  // +1 when reading forward, -1 backward
+  int32_t direction_ = 0;
+  // the previous run ended, queued requests are stale
+  bool reset_ = false;
+};
+
+// Spots sequential and reverse runs in the stream of touched chunk ids and
+// decides how far ahead of the reader to load. The window starts small,
+// doubles every time the reader catches up with the prefetched chunks and
+// halves when prefetched chunks get evicted unused.
+class ReadaheadState {
+public:
+  static constexpr ChunkID kNone = std::numeric_limits<ChunkID>::max();
+  static constexpr uint32_t kMinWindow = 2;
+
+  explicit ReadaheadState(uint32_t max_window)
+      : max_window_(max_window),
+        window_(std::min(kMinWindow, max_window)) {}
+
+  // `caught_up` tells the reader had to wait for the chunk, `chunk_count`
+  // bounds the ids that may be requested.
+  ReadaheadRequest on_access(ChunkID id, bool caught_up, ChunkID chunk_count) {
+    if (id == last_ || max_window_ == 0) {
+      return {};
+    }
+
+    int32_t direction = 0;
+    if (last_ != kNone && id == last_ + 1) {
+      direction = 1;
+    } else if (last_ != kNone && id + 1 == last_) {
+      direction = -1;
+    }
+    last_ = id;
+
+    ReadaheadRequest req;
+    if (direction == 0 || direction != direction_) {
+      req.reset_ = direction_ != 0;
+      direction_ = direction;
+      window_ = std::min(kMinWindow, max_window_);
+      issued_until_ = id;
+      if (direction == 0) {
+        return req;
+      }
+    } else if (caught_up) {
+      window_ = std::min(window_ * 2, max_window_);
+    }
+
+    // top the window up, skipping what is already requested
+    int64_t target = int64_t(id) + int64_t(direction) * window_;
+    target = std::clamp<int64_t>(target, 0, int64_t(chunk_count) - 1);
+    int64_t start = int64_t(issued_until_) + direction;
+    if ((int64_t(id) - int64_t(issued_until_)) * direction >= 0) {
+      start = int64_t(id) + direction;
+    }
+    if ((target - start) * direction < 0) {
+      return req;
+    }
+
+    req.start_ = ChunkID(start);
+    req.count_ = uint32_t((target - start) * direction + 1);
+    req.direction_ = direction;
+    issued_until_ = ChunkID(target);
+    return req;
+  }
+
+  void shrink() {
+    window_ = std::max(std::min(kMinWindow, max_window_), window_ / 2);
+  }
+
+  uint32_t max_window() const {
+    return max_window_;
+  }
+
+  uint32_t window() const {
+    return direction_ == 0 ? 0 : window_;
+  }
+
+private:
+  uint32_t max_window_;
+  uint32_t window_;
+  ChunkID last_ = kNone;
+  ChunkID issued_until_ = kNone;
+  int32_t direction_ = 0;
+};
+
+}  // namespace oned
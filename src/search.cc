@@ -0,0 +1,209 @@
+#include "search.hh"
+#include "byte_scan.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace oned {
+
+struct TaskResult {
+  bool done_ = false;
+  std::vector<uint64_t> matches_;
+  Result<void> status_ = outcome::success();
+};
+
+struct Search::State {
+  State(ChunkManager &mgr, ThreadPool &pool, std::string pattern,
+        SearchOptions options)
+      : mgr_(mgr),
+        pool_(pool),
+        pattern_(std::move(pattern)),
+        // whole chunks, so no chunk is loaded by two tasks
+        task_size_((std::max<uint64_t>(options.task_size, 1) +
+                    mgr.chunk_size() - 1) /
+                   mgr.chunk_size() * mgr.chunk_size()),
+        max_pending_(std::max(options.max_pending_tasks, 1U)),
+        task_count_(pattern_.empty()
+                        ? 0
+                        : (mgr.size() + task_size_ - 1) / task_size_) {}
+
+  ChunkManager &mgr_;
+  ThreadPool &pool_;
+  const std::string pattern_;
+  const uint64_t task_size_;
+  const uint32_t max_pending_;
+  const uint64_t task_count_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // results of the tasks from consumed_ on
+  std::deque<TaskResult> results_;
+  uint64_t consumed_ = 0;
+  uint64_t submitted_ = 0;
+  // matches of the front task already handed out
+  size_t pos_ = 0;
+  size_t running_ = 0;
+
+  std::atomic<bool> cancelled_{false};
+  std::atomic<uint64_t> scanned_{0};
+
+  Result<void> scan_range(uint64_t begin, uint64_t end,
+                          std::vector<uint64_t> &matches);
+  static void submit_tasks(const std::shared_ptr<State> &state);
+};
+
+static Result<std::string> read_range(ChunkManager &mgr, uint64_t offset,
+                                      uint64_t length) {
+  std::string ret;
+  for (auto view : calculate_chunk_views(offset, length, mgr.chunk_size())) {
+    ret += TRYX(mgr.read(view));
+  }
+  return ret;
+}
+
+static void find_all(std::string_view data, std::string_view pattern,
+                     uint64_t base, std::vector<uint64_t> &matches) {
+  for (size_t pos = 0;;) {
+    auto found = find_substring(data.substr(pos), pattern);
+    if (found == std::string_view::npos) {
+      return;
+    }
+    matches.push_back(base + pos + found);
+    pos += found + 1;
+  }
+}
+
+// Matches starting in [begin, end), including those running past `end`.
+Result<void> Search::State::scan_range(uint64_t begin, uint64_t end,
+                                       std::vector<uint64_t> &matches) {
+  std::string_view pattern = pattern_;
+  auto keep = pattern.size() - 1;
+  // the last `keep` bytes before the current chunk, within the range
+  std::string carry;
+
+  // report the matches that start in `carry` and end in `next`, the others
+  // were found before or will be found within `next`
+  auto straddling = [&](uint64_t base, std::string_view next) {
+    if (carry.empty()) {
+      return;
+    }
+    auto joint = carry;
+    joint.append(next.substr(0, keep));
+    std::vector<uint64_t> found;
+    find_all(joint, pattern, 0, found);
+    for (auto pos : found) {
+      if (pos < carry.size() && pos + pattern.size() > carry.size()) {
+        matches.push_back(base - carry.size() + pos);
+      }
+    }
+  };
+
+  for (auto view :
+       calculate_chunk_views(begin, end - begin, mgr_.chunk_size())) {
+    if (cancelled_.load(std::memory_order_relaxed)) {
+      return outcome::success();
+    }
+    auto handle = TRYX(mgr_.get_chunk(view));
+    auto data = handle.view();
+    auto base = uint64_t(view.id_) * mgr_.chunk_size() + view.offset_;
+    straddling(base, data);
+    find_all(data, pattern, base, matches);
+    carry.append(data.substr(data.size() - std::min(keep, data.size())));
+    carry.erase(0, carry.size() - std::min(keep, carry.size()));
+    scanned_.fetch_add(data.size(), std::memory_order_relaxed);
+  }
+  if (keep != 0 && end < mgr_.size()) {
+    auto next =
+        TRYX(read_range(mgr_, end, std::min(keep, mgr_.size() - end)));
+    straddling(end, next);
+  }
+  return outcome::success();
+}
+
+// Keep up to max_pending_ tasks ahead of the consumer, mutex_ held.
+void Search::State::submit_tasks(const std::shared_ptr<State> &state) {
+  auto &s = *state;
+  while (s.submitted_ < s.task_count_ &&
+         s.submitted_ - s.consumed_ < s.max_pending_ &&
+         !s.cancelled_.load(std::memory_order_relaxed)) {
+    auto task = s.submitted_++;
+    s.results_.emplace_back();
+    s.running_++;
+    s.pool_.submit([state, task] {
+      auto &s = *state;
+      auto begin = task * s.task_size_;
+      auto end = std::min(begin + s.task_size_, s.mgr_.size());
+      std::vector<uint64_t> matches;
+      auto ret = s.scan_range(begin, end, matches);
+
+      std::lock_guard lock(s.mutex_);
+      auto &r = s.results_[task - s.consumed_];
+      r.matches_ = std::move(matches);
+      r.status_ = std::move(ret);
+      r.done_ = true;
+      s.running_--;
+      s.cv_.notify_all();
+    });
+  }
+}
+
+Search::Search(ChunkManager &mgr, ThreadPool &pool, std::string pattern,
+               SearchOptions options)
+    : state_(std::make_shared<State>(mgr, pool, std::move(pattern),
+                                     options)) {
+  std::lock_guard lock(state_->mutex_);
+  State::submit_tasks(state_);
+}
+
+Search::~Search() {
+  if (state_) {
+    cancel();
+    std::unique_lock lock(state_->mutex_);
+    state_->cv_.wait(lock, [this] { return state_->running_ == 0; });
+  }
+}
+
+Result<std::optional<uint64_t>> Search::next() {
+  auto &s = *state_;
+  std::unique_lock lock(s.mutex_);
+  while (true) {
+    if (s.cancelled_.load(std::memory_order_relaxed) ||
+        s.consumed_ == s.task_count_) {
+      return std::nullopt;
+    }
+    auto &front = s.results_.front();
+    if (!front.done_) {
+      s.cv_.wait(lock, [&] {
+        return front.done_ || s.cancelled_.load(std::memory_order_relaxed);
+      });
+      continue;
+    }
+    if (!front.status_) {
+      // nothing past a failed range can be reported in order
+      s.cancelled_.store(true, std::memory_order_relaxed);
+      return std::move(front.status_).error();
+    }
+    if (s.pos_ < front.matches_.size()) {
+      return front.matches_[s.pos_++];
+    }
+    s.results_.pop_front();
+    s.consumed_++;
+    s.pos_ = 0;
+    State::submit_tasks(state_);
+  }
+}
+
+void Search::cancel() {
+  {
+    std::lock_guard lock(state_->mutex_);
+    state_->cancelled_.store(true, std::memory_order_relaxed);
+  }
+  state_->cv_.notify_all();
+}
+
+uint64_t Search::scanned() const {
+  return state_->scanned_.load(std::memory_order_relaxed);
+}
+
+}  // namespace oned
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "chunk_manager.hh"
+#include "noncopyable.hh"
+#include "thread_pool.hh"
+
+#include <atomic>
+#include <memory>
+#include <optional>
+
+namespace oned {
+
+struct SearchOptions {
+  // Bytes scanned by one task, rounded up to whole chunks. Small tasks get
+  // the first matches out sooner, large ones cost less scheduling.
+  uint64_t task_size = uint64_t(4) << 20;
+  // Tasks scanned ahead of the consumer, bounds the matches held in memory
+  // while nobody calls next().
+  uint32_t max_pending_tasks = 64;
+};
+
+// Literal pattern search over a ChunkManager. The file is split into ranges
+// of whole chunks scanned in parallel on a ThreadPool. Matches straddling
+// chunk or range boundaries are found too, overlapping matches are all
+// reported, and next() hands them out in offset order as soon as every
+// range in front of them is done.
+class Search : NonCopyable {
+public:
+  // `mgr` and `pool` must outlive the search.
+  Search(ChunkManager &mgr, ThreadPool &pool, std::string pattern,
+         SearchOptions options = {});
+
+  Search(Search &&) noexcept = default;
+  Search &operator=(Search &&) noexcept = default;
+  // Cancels and waits for the running tasks.
+  ~Search();
+
+  // Offset of the next match, blocking until it is known. nullopt once the
+  // file is exhausted or the search got cancelled.
+  Result<std::optional<uint64_t>> next();
+
+  // Stop scanning, e.g. because the user changed the query. Safe to call
+  // from any thread, a blocked next() returns nullopt.
+  void cancel();
+
+  // bytes scanned so far
+  uint64_t scanned() const;
+
+private:
+  struct State;
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace oned
@@ -0,0 +1,131 @@
+#include "search.hh"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+using namespace oned;
+
+class SearchTest : public ::testing::Test {
+protected:
+  void TearDown() override {
+    mgr_.reset();
+    std::remove(path_.c_str());
+  }
+
+  void write_file(const std::string& data, uint32_t chunk_size) {
+    data_ = data;
+    path_ = ::testing::TempDir() + "search";
+    auto* f = std::fopen(path_.c_str(), "wb");
+    ASSERT_NE(f, nullptr);
+    std::fwrite(data.data(), 1, data.size(), f);
+    std::fclose(f);
+    auto loader = ChunkLoader::open(path_.c_str(),
+                                    {.kind = ChunkLoaderKind::stdio});
+    ASSERT_TRUE(loader);
+    mgr_ = std::make_unique<ChunkManager>(std::move(loader).value(),
+                                          chunk_size, chunk_size * 16,
+                                          ChunkManagerOptions{.shard_count = 4});
+  }
+
+  std::vector<uint64_t> expected(std::string_view pattern) const {
+    std::vector<uint64_t> ret;
+    for (auto pos = data_.find(pattern); pos != std::string::npos;
+         pos = data_.find(pattern, pos + 1)) {
+      ret.push_back(pos);
+    }
+    return ret;
+  }
+
+  static std::vector<uint64_t> collect(Search& search) {
+    std::vector<uint64_t> ret;
+    while (true) {
+      auto match = search.next();
+      EXPECT_TRUE(match);
+      if (!match || !match.value()) {
+        return ret;
+      }
+      ret.push_back(*match.value());
+    }
+  }
+
+  std::string data_;
+  std::string path_;
+  std::unique_ptr<ChunkManager> mgr_;
+};
+
+TEST_F(SearchTest, MatchesInOrder) {
+  std::mt19937 rng(42);
+  std::string data(200000, 'a');
+  for (auto& c : data) {
+    c = "abc\n"[rng() % 4];
+  }
+  // small chunks and tasks put plenty of matches across both boundaries
+  write_file(data, 64);
+  ThreadPool pool(4);
+  for (std::string pattern : {"a", "ab", "abca", "aaaa", "c\nab\nc", "zz"}) {
+    SCOPED_TRACE(pattern);
+    for (uint64_t task_size : {1, 64, 1000, 1 << 20}) {
+      Search search(*mgr_, pool, pattern,
+                    {.task_size = task_size, .max_pending_tasks = 8});
+      EXPECT_EQ(collect(search), expected(pattern));
+      EXPECT_EQ(search.scanned(), data_.size());
+    }
+  }
+}
+
+TEST_F(SearchTest, PatternLongerThanChunk) {
+  std::string data;
+  for (int i = 0; i < 2000; i++) {
+    data += fmt::format("line {} ", i % 7);
+  }
+  write_file(data, 16);
+  ThreadPool pool(3);
+  for (std::string pattern : {"line 3 line 4 line 5 line 6", "line 6 line 0"}) {
+    Search search(*mgr_, pool, pattern, {.task_size = 48});
+    EXPECT_EQ(collect(search), expected(pattern));
+  }
+  Search empty(*mgr_, pool, "");
+  EXPECT_EQ(collect(empty), std::vector<uint64_t>{});
+}
+
+TEST_F(SearchTest, Cancel) {
+  write_file(std::string(4 << 20, 'x'), 4096);
+  ThreadPool pool(2);
+  // every byte matches, the consumer falls behind and the tasks wait
+  Search search(*mgr_, pool, "x", {.task_size = 4096, .max_pending_tasks = 4});
+  auto first = search.next();
+  ASSERT_TRUE(first);
+  EXPECT_EQ(first.value(), 0);
+  search.cancel();
+  auto after = search.next();
+  ASSERT_TRUE(after);
+  EXPECT_FALSE(after.value());
+  EXPECT_LT(search.scanned(), data_.size());
+
+  // a fresh query on the same pool runs to the end
+  Search again(*mgr_, pool, "xxxxxxxx", {.task_size = 1 << 20});
+  uint64_t count = 0;
+  while (auto match = again.next()) {
+    if (!match.value()) {
+      break;
+    }
+    count++;
+  }
+  EXPECT_EQ(count, data_.size() - 7);
+}
+
+TEST(ThreadPoolTest, RunsEverything) {
+  std::atomic<int> done{0};
+  {
+    ThreadPool pool(4);
+    for (int i = 0; i < 1000; i++) {
+      pool.submit([&pool, &done] {
+        // tasks spawned from a worker land in its own queue
+        pool.submit([&done] { done++; });
+        done++;
+      });
+    }
+  }
+  EXPECT_EQ(done.load(), 2000);
+}
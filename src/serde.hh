@@ -1,29 +1,93 @@
 #pragma once
 
+#include "outcome.hh"
+
+#include <sys/uio.h>
+
 #include <boost/endian/conversion.hpp>
 #include <boost/pfr.hpp>
+#include <bit>
 #include <concepts>
+#include <cstring>
+#include <limits>
 #include <numeric>  // IWYU pragma: keep
 #include <optional>
+#include <span>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 namespace oned {
 
 namespace detail {
-uint64_t zig_zag_encode(int64_t value) {
+inline uint64_t zig_zag_encode(int64_t value) {
   return (value << 1) ^ (value >> 63);
 }
-int64_t zig_zag_decode(uint64_t value) {
+inline int64_t zig_zag_decode(uint64_t value) {
   return int64_t(value >> 1 ^ -(value & 1));
 }
 }  // namespace detail
 
+struct SerializerOptions {
+  // Strings of at least this many bytes are referenced instead of copied,
+  // see iovecs(). They must stay alive and unchanged until the output is
+  // written. 0 copies every string.
+  std::size_t gather_threshold = 0;
+  // Only add up the sizes, for a sizing pass.
+  bool count_only = false;
+};
+
 struct Serializer {
+  Serializer() = default;
+  explicit Serializer(SerializerOptions options) : options_(options) {}
+
   std::string buffer;
 
+  // The whole encoding, referenced strings get copied in.
   std::string take() {
-    return std::move(buffer);
+    if (references_.empty()) {
+      return std::move(buffer);
+    }
+    std::string ret;
+    ret.reserve(size_);
+    for (auto &iov : iovecs()) {
+      ret.append(static_cast<const char *>(iov.iov_base), iov.iov_len);
+    }
+    buffer.clear();
+    references_.clear();
+    return ret;
+  }
+
+  // The encoding as writev-ready pieces of `buffer` and referenced strings.
+  std::vector<iovec> iovecs() const {
+    std::vector<iovec> ret;
+    std::size_t pos = 0;
+    auto piece = [&](const char *p, std::size_t n) {
+      if (n != 0) {
+        ret.push_back(iovec{const_cast<char *>(p), n});  // NOLINT
+      }
+    };
+    for (auto &ref : references_) {
+      piece(buffer.data() + pos, ref.at_ - pos);
+      piece(ref.data_, ref.size_);
+      pos = ref.at_;
+    }
+    piece(buffer.data() + pos, buffer.size() - pos);
+    return ret;
+  }
+
+  // bytes encoded so far, referenced strings included
+  std::size_t size() const {
+    return size_;
+  }
+
+  // bytes copied into `buffer` so far, or that would be when count_only
+  std::size_t buffered() const {
+    return buffered_;
+  }
+
+  void reserve(std::size_t size) {
+    buffer.reserve(size);
   }
 
   void write_int(int64_t value) {
@@ -52,32 +116,159 @@ struct Serializer {
   void write_str(std::string_view str) {
     pack_str(str.data(), str.size());
   }
+  // Raw bytes without length prefix, referenced like strings.
+  void write_block(const void *p, std::size_t size) {
+    pack_block(static_cast<const char *>(p), size);
+  }
 
 private:
+  // a string spliced in at buffer offset `at_`
+  struct Reference {
+    std::size_t at_;
+    const char *data_;
+    std::size_t size_;
+  };
+
   template <typename T>
   void pack_int(T value) {
     T v = boost::endian::native_to_little(value);
-    auto size = buffer.size();
-    buffer.resize(size + sizeof(value));
-    std::memcpy(buffer.data() + size, &v, sizeof(value));  // NOLINT
+    copy(reinterpret_cast<const char *>(&v), sizeof(value));  // NOLINT
   }
   void pack_str(const char *p, std::size_t length) {
     write_uint(length);
-    auto size = buffer.size();
-    buffer.resize(size + length);
-    std::memcpy(buffer.data() + size, p, length);  // NOLINT
+    pack_block(p, length);
+  }
+  void pack_block(const char *p, std::size_t length) {
+    if (options_.gather_threshold == 0 || length < options_.gather_threshold) {
+      copy(p, length);
+      return;
+    }
+    size_ += length;
+    if (!options_.count_only) {
+      references_.push_back(Reference{buffer.size(), p, length});
+    }
+  }
+  void copy(const char *p, std::size_t length) {
+    size_ += length;
+    buffered_ += length;
+    if (!options_.count_only) {
+      buffer.append(p, length);
+    }
   }
+
+  SerializerOptions options_;
+  std::size_t size_ = 0;
+  std::size_t buffered_ = 0;
+  std::vector<Reference> references_;
 };
 
+// Reads past the end of `buffer` fail softly: they return zeros or empty
+// strings and mark the deserializer truncated, check status() once the
+// whole value is decoded.
 struct Deserializer {
   std::string_view buffer;
   std::size_t pos = 0;
+  bool truncated = false;
+
+  Result<void> status() const {
+    if (truncated) {
+      return make_error(GenericErrc::bad_message,
+                        lazy_format("truncated input of {} bytes",
+                                    buffer.size()));
+    }
+    return outcome::success();
+  }
 
   int64_t read_int() {
     auto value = read_uint();
     return detail::zig_zag_decode(value);
   }
   uint64_t read_uint() {
+    // one check covers the longest encoding, only the last few bytes of a
+    // buffer take the careful path
+    if (buffer.size() - pos >= kMaxUintSize) [[likely]] {
+      const auto *p = buffer.data() + pos;
+      auto tag = static_cast<uint8_t>(p[0]);
+      if (tag < 0xFF - 2) {
+        pos++;
+        return tag;
+      }
+      // branch per width rather than computing it, so the next read does
+      // not wait on this tag
+      uint64_t value = 0;
+      if (tag == 0xFF - 2) {
+        uint16_t v;
+        std::memcpy(&v, p + 1, sizeof(v));  // NOLINT
+        value = boost::endian::little_to_native(v);
+        pos += 1 + sizeof(v);
+      } else if (tag == 0xFF - 1) {
+        uint32_t v;
+        std::memcpy(&v, p + 1, sizeof(v));  // NOLINT
+        value = boost::endian::little_to_native(v);
+        pos += 1 + sizeof(v);
+      } else {
+        std::memcpy(&value, p + 1, sizeof(value));  // NOLINT
+        value = boost::endian::little_to_native(value);
+        pos += 1 + sizeof(value);
+      }
+      return value;
+    }
+    return read_uint_checked();
+  }
+
+  // An element count, every element takes at least a byte, so counts beyond
+  // the remaining input are truncation rather than a huge allocation.
+  std::size_t read_size() {
+    auto size = read_uint();
+    if (size > buffer.size() - pos) {
+      fail();
+      return 0;
+    }
+    return size;
+  }
+
+  std::string_view read_str() {
+    return read_block(read_uint());
+  }
+
+  std::string_view read_block(std::size_t size) {
+    if (size > buffer.size() - pos) {
+      fail();
+      return {};
+    }
+    auto block = buffer.substr(pos, size);
+    pos += size;
+    return block;
+  }
+
+  // Decode `out.size()` consecutive ints, zig-zag encoded when T is signed.
+  // Runs of values below 0x80 are decoded 8 at a time, they are 8 tag bytes
+  // with the high bit clear.
+  template <std::integral T>
+  void read_ints(std::span<T> out) {
+    constexpr uint64_t kHighBits = 0x8080808080808080;
+    std::size_t i = 0;
+    while (i < out.size()) {
+      uint64_t word = kHighBits;
+      if (out.size() - i >= 8 && buffer.size() - pos >= 8) {
+        std::memcpy(&word, buffer.data() + pos, sizeof(word));  // NOLINT
+        word = boost::endian::little_to_native(word);
+      }
+      if ((word & kHighBits) == 0) {
+        for (int b = 0; b < 8; b++) {
+          out[i++] = decode_int<T>((word >> (b * 8)) & 0xFF);
+        }
+        pos += 8;
+      } else {
+        out[i++] = decode_int<T>(read_uint());
+      }
+    }
+  }
+
+private:
+  static constexpr std::size_t kMaxUintSize = 1 + sizeof(uint64_t);
+
+  uint64_t read_uint_checked() {
     auto i = pick_int<uint8_t>();
     if (i < 0xFF - 2) {
       return i;
@@ -91,16 +282,26 @@ struct Deserializer {
     return pick_int<uint64_t>();
   }
 
-  std::string_view read_str() {
-    auto length = read_uint();
-    auto str = buffer.substr(pos, length);
-    pos += length;
-    return str;
+  template <std::integral T>
+  static T decode_int(uint64_t value) {
+    if constexpr (std::is_signed_v<T>) {
+      return T(detail::zig_zag_decode(value));
+    } else {
+      return T(value);
+    }
+  }
+
+  void fail() {
+    truncated = true;
+    pos = buffer.size();
   }
 
-private:
   template <typename T>
   T pick_int() {
+    if (buffer.size() - pos < sizeof(T)) {
+      fail();
+      return 0;
+    }
     T value;
     std::memcpy(&value, buffer.data() + pos, sizeof(value));  // NOLINT
     pos += sizeof(value);
@@ -128,15 +329,15 @@ void serialize(Serializer &serializer, T value) {
   serializer.write_uint(v.u);
 }
 
-void serialize(Serializer &serializer, const char *str) {
+inline void serialize(Serializer &serializer, const char *str) {
   serializer.write_str(str);
 }
 
-void serialize(Serializer &serializer, const std::string &str) {
+inline void serialize(Serializer &serializer, const std::string &str) {
   serializer.write_str(str);
 }
 
-void serialize(Serializer &serializer, std::string_view str) {
+inline void serialize(Serializer &serializer, std::string_view str) {
   serializer.write_str(str);
 }
 
@@ -170,22 +371,97 @@ void deserialize(Deserializer &deserializer, T &value) {
   value = v.f;
 }
 
-void deserialize(Deserializer &deserializer, std::string &value) {
+inline void deserialize(Deserializer &deserializer, std::string &value) {
   value = std::string(deserializer.read_str());
 }
 
-void deserialize(Deserializer &deserializer, std::string_view &value) {
+inline void deserialize(Deserializer &deserializer, std::string_view &value) {
   value = deserializer.read_str();
 }
 
 template <typename T>
 void deserialize(Deserializer &deserializer, std::vector<T> &value) {
-  value.resize(deserializer.read_uint());
+  value.resize(deserializer.read_size());
   for (auto &v : value) {
     deserialize(deserializer, v);
   }
 }
 
+// vector<bool> has no contiguous storage to decode into
+template <std::integral T>
+  requires(!std::same_as<T, bool>)
+void deserialize(Deserializer &deserializer, std::vector<T> &value) {
+  value.resize(deserializer.read_size());
+  deserializer.read_ints(std::span(value));
+}
+
+// Opt-in for structs whose bytes are their encoding: vectors of them are
+// copied as one block rather than field by field. The struct must be
+// trivially copyable, without padding, and its fields integers, which are
+// stored little-endian.
+template <typename T>
+inline constexpr bool kBlockSerde = false;
+
+template <typename T>
+concept BlockSerde = kBlockSerde<T>;
+
+template <BlockSerde T>
+void serialize(Serializer &serializer, const std::vector<T> &value) {
+  static_assert(std::is_trivially_copyable_v<T> &&
+                std::has_unique_object_representations_v<T>);
+  serializer.write_uint(value.size());
+  if constexpr (std::endian::native == std::endian::little) {
+    serializer.write_block(value.data(), value.size() * sizeof(T));
+  } else {
+    for (auto v : value) {
+      boost::pfr::for_each_field(
+          v, [](auto &field) { boost::endian::native_to_little_inplace(field); });
+      serializer.write_block(&v, sizeof(v));
+    }
+  }
+}
+
+template <BlockSerde T>
+void deserialize(Deserializer &deserializer, std::vector<T> &value) {
+  auto size = deserializer.read_size();
+  auto block = deserializer.read_block(size * sizeof(T));
+  value.resize(block.size() / sizeof(T));
+  if (!block.empty()) {
+    std::memcpy(value.data(), block.data(), block.size());  // NOLINT
+  }
+  if constexpr (std::endian::native != std::endian::little) {
+    for (auto &v : value) {
+      boost::pfr::for_each_field(
+          v, [](auto &field) { boost::endian::little_to_native_inplace(field); });
+    }
+  }
+}
+
+// A sorted column of ints, stored as varint deltas from the previous value,
+// e.g. file offsets take a byte or two each instead of 5 or 9. Any order
+// round-trips, only the size suffers.
+template <std::unsigned_integral T>
+struct DeltaColumn {
+  std::vector<T> values_;
+};
+
+template <std::unsigned_integral T>
+void serialize(Serializer &serializer, const DeltaColumn<T> &value) {
+  serializer.write_uint(value.values_.size());
+  T prev = 0;
+  for (auto v : value.values_) {
+    serializer.write_uint(T(v - prev));
+    prev = v;
+  }
+}
+
+template <std::unsigned_integral T>
+void deserialize(Deserializer &deserializer, DeltaColumn<T> &value) {
+  deserialize(deserializer, value.values_);
+  std::inclusive_scan(value.values_.begin(), value.values_.end(),
+                      value.values_.begin());
+}
+
 template <typename T>
 void deserialize(Deserializer &deserializer, std::optional<T> &value) {
   if (deserializer.read_uint()) {
@@ -267,7 +543,7 @@ void serialize(Serializer &serializer, const C &value) {
 
 template <AssociativeContainer C>
 void deserialize(Deserializer &deserializer, C &container) {
-  auto size = deserializer.read_uint();
+  auto size = deserializer.read_size();
   container.clear();
   for (std::size_t i = 0; i < size; ++i) {
     typename C::key_type key;
@@ -288,7 +564,7 @@ void serialize(Serializer &serializer, const C &container) {
 
 template <SequenceContainer C>
 void deserialize(Deserializer &deserializer, C &container) {
-  auto size = deserializer.read_uint();
+  auto size = deserializer.read_size();
   container.clear();
   for (std::size_t i = 0; i < size; ++i) {
     typename C::value_type v;
@@ -307,7 +583,7 @@ void serialize(Serializer &serializer, const C &container) {
 
 template <SetContainer C>
 void deserialize(Deserializer &deserializer, C &container) {
-  auto size = deserializer.read_uint();
+  auto size = deserializer.read_size();
   container.clear();
   for (std::size_t i = 0; i < size; ++i) {
     typename C::value_type v;
@@ -316,4 +592,14 @@ void deserialize(Deserializer &deserializer, C &container) {
   }
 }
 
+// Sizing pass: the bytes serialize() copies into the buffer of a serializer
+// with `gather_threshold`, to reserve() them up front.
+template <typename T>
+std::size_t buffered_size(const T &value, std::size_t gather_threshold = 0) {
+  Serializer s(
+      {.gather_threshold = gather_threshold, .count_only = true});
+  serialize(s, value);
+  return s.buffered();
+}
+
 }  // namespace oned
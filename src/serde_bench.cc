@@ -0,0 +1,140 @@
+#include "serde.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+using namespace oned;
+
+struct BenchCheckpoint {
+  uint64_t offset_;
+  uint64_t line_;
+};
+
+struct BenchBlockCheckpoint {
+  uint64_t offset_;
+  uint64_t line_;
+};
+
+template <>
+inline constexpr bool oned::kBlockSerde<BenchBlockCheckpoint> = true;
+
+struct BenchIndex {
+  uint32_t version_;
+  std::vector<BenchCheckpoint> checkpoints_;
+  std::vector<uint32_t> lengths_;
+};
+
+// Shaped like a saved LineIndex of a 100 GB file, plus a column of small
+// ints such as line lengths.
+static const std::string &encoded_index() {
+  static const auto ret = [] {
+    std::mt19937_64 rng(42);
+    BenchIndex index{.version_ = 2, .checkpoints_ = {}, .lengths_ = {}};
+    uint64_t offset = 0;
+    uint64_t line = 0;
+    for (int i = 0; i < 500'000; i++) {
+      offset += 100'000 + rng() % 100'000;
+      line += 1024;
+      index.checkpoints_.push_back({offset, line});
+      index.lengths_.push_back(40 + rng() % 80);
+    }
+    Serializer s;
+    serialize(s, index);
+    return s.take();
+  }();
+  return ret;
+}
+
+static void BM_DeserializeIndex(benchmark::State &state) {
+  const auto &data = encoded_index();
+  for (auto _ : state) {
+    Deserializer d{.buffer = data};
+    BenchIndex index;
+    deserialize(d, index);
+    benchmark::DoNotOptimize(index);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * data.size());
+}
+BENCHMARK(BM_DeserializeIndex)->Unit(benchmark::kMillisecond);
+
+// Encode and decode the same index, as a save and reopen do.
+static void BM_SerdeRoundTrip(benchmark::State &state) {
+  const auto &data = encoded_index();
+  Deserializer d{.buffer = data};
+  BenchIndex index;
+  deserialize(d, index);
+  for (auto _ : state) {
+    Serializer s;
+    s.reserve(data.size());
+    serialize(s, index);
+    Deserializer back{.buffer = s.buffer};
+    BenchIndex loaded;
+    deserialize(back, loaded);
+    benchmark::DoNotOptimize(loaded);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * data.size());
+}
+BENCHMARK(BM_SerdeRoundTrip)->Unit(benchmark::kMillisecond);
+
+static void BM_DeserializeLengths(benchmark::State &state) {
+  std::mt19937_64 rng(42);
+  std::vector<uint32_t> lengths;
+  for (int i = 0; i < 500'000; i++) {
+    lengths.push_back(40 + rng() % 80);
+  }
+  Serializer s;
+  serialize(s, lengths);
+  auto data = s.take();
+  for (auto _ : state) {
+    Deserializer d{.buffer = data};
+    std::vector<uint32_t> out;
+    deserialize(d, out);
+    benchmark::DoNotOptimize(out);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * data.size());
+}
+BENCHMARK(BM_DeserializeLengths)->Unit(benchmark::kMillisecond);
+
+// 10M checkpoints, a LineIndex of a 1 TB file, serialized field by field,
+// as one block, and plain memcpy for reference.
+template <typename Checkpoint>
+static std::vector<Checkpoint> checkpoints() {
+  std::vector<Checkpoint> ret;
+  uint64_t offset = 0;
+  for (uint64_t i = 0; i < 10'000'000; i++) {
+    offset += 100'000 + i % 1000;
+    ret.push_back({offset, i * 1024});
+  }
+  return ret;
+}
+
+template <typename Checkpoint>
+static void BM_SerializeCheckpoints(benchmark::State &state) {
+  auto data = checkpoints<Checkpoint>();
+  auto size = buffered_size(data);
+  for (auto _ : state) {
+    Serializer s;
+    s.reserve(size);
+    serialize(s, data);
+    benchmark::DoNotOptimize(s.buffer);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations() * size));
+}
+BENCHMARK(BM_SerializeCheckpoints<BenchCheckpoint>)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SerializeCheckpoints<BenchBlockCheckpoint>)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_MemcpyCheckpoints(benchmark::State &state) {
+  auto data = checkpoints<BenchCheckpoint>();
+  auto size = data.size() * sizeof(BenchCheckpoint);
+  for (auto _ : state) {
+    std::string out;
+    out.reserve(size);
+    out.append(reinterpret_cast<const char *>(data.data()), size);  // NOLINT
+    benchmark::DoNotOptimize(out);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations() * size));
+}
+BENCHMARK(BM_MemcpyCheckpoints)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,204 @@
+#include "file_util.hh"
+#include "serde.hh"
+
+#include <gtest/gtest.h>
+
+#include <map>
+
+using namespace oned;
+
+namespace test {
+
+struct Blob {
+  uint32_t id_ = 0;
+  std::string name_;
+  std::string body_;
+  std::optional<int64_t> offset_;
+  std::map<std::string, uint64_t> tags_;
+
+  bool operator==(const Blob&) const = default;
+};
+
+struct Point {
+  uint64_t offset_;
+  uint32_t line_;
+  int32_t delta_;
+
+  bool operator==(const Point&) const = default;
+};
+
+}  // namespace test
+
+template <>
+inline constexpr bool oned::kBlockSerde<test::Point> = true;
+
+static test::Blob make_blob() {
+  return test::Blob{
+      .id_ = 7,
+      .name_ = "small",
+      .body_ = std::string(100000, 'b'),
+      .offset_ = -123456789,
+      .tags_ = {{"a", 1}, {"b", uint64_t(1) << 40}},
+  };
+}
+
+static std::string join(const std::vector<iovec>& pieces) {
+  std::string ret;
+  for (auto& iov : pieces) {
+    ret.append(static_cast<const char*>(iov.iov_base), iov.iov_len);
+  }
+  return ret;
+}
+
+TEST(Serializer, round_trip) {
+  auto blob = make_blob();
+  Serializer s;
+  serialize(s, blob);
+  ASSERT_EQ(s.size(), s.buffer.size());
+  auto data = s.take();
+
+  Deserializer d{.buffer = data};
+  test::Blob loaded;
+  deserialize(d, loaded);
+  ASSERT_EQ(loaded, blob);
+  ASSERT_EQ(d.pos, data.size());
+}
+
+TEST(Serializer, gathers_large_strings) {
+  auto blob = make_blob();
+  Serializer copied;
+  serialize(copied, blob);
+
+  Serializer s({.gather_threshold = 4096});
+  s.reserve(buffered_size(blob, 4096));
+  auto capacity = s.buffer.capacity();
+  serialize(s, blob);
+  // the sizing pass was exact and the body was not copied
+  ASSERT_EQ(s.buffer.size(), buffered_size(blob, 4096));
+  ASSERT_EQ(s.buffer.capacity(), capacity);
+  ASSERT_LT(s.buffer.size(), 100);
+  ASSERT_EQ(s.size(), copied.size());
+
+  auto pieces = s.iovecs();
+  ASSERT_EQ(pieces.size(), 3);
+  ASSERT_EQ(pieces[1].iov_base, blob.body_.data());
+  ASSERT_EQ(join(pieces), copied.buffer);
+  ASSERT_EQ(s.take(), copied.buffer);
+}
+
+TEST(Serializer, count_only) {
+  auto blob = make_blob();
+  Serializer s({.count_only = true});
+  serialize(s, blob);
+  ASSERT_TRUE(s.buffer.empty());
+  ASSERT_EQ(s.size(), buffered_size(blob));
+  ASSERT_TRUE(s.iovecs().empty());
+}
+
+TEST(Serializer, write_iovecs) {
+  auto blob = make_blob();
+  Serializer s({.gather_threshold = 1});
+  serialize(s, blob);
+  auto path = ::testing::TempDir() + "serde_write_iovecs";
+  ASSERT_TRUE(write_file_atomic(path.c_str(), s.iovecs()));
+  auto data = read_whole_file(path.c_str());
+  ASSERT_TRUE(data);
+  ASSERT_EQ(data.value(), join(s.iovecs()));
+  std::remove(path.c_str());
+}
+
+TEST(Deserializer, truncated_input_fails) {
+  auto blob = make_blob();
+  blob.body_ = "body";
+  Serializer s;
+  serialize(s, blob);
+  auto data = s.take();
+  for (std::size_t n = 0; n < data.size(); n++) {
+    Deserializer d{.buffer = std::string_view(data).substr(0, n)};
+    test::Blob loaded;
+    deserialize(d, loaded);
+    ASSERT_FALSE(d.status()) << n;
+  }
+
+  // a count larger than the input can hold allocates nothing
+  Serializer huge;
+  huge.write_uint(uint64_t(1) << 60);
+  auto encoded = huge.take();
+  Deserializer d{.buffer = encoded};
+  std::vector<std::string> strings;
+  deserialize(d, strings);
+  ASSERT_FALSE(d.status());
+  ASSERT_TRUE(strings.empty());
+}
+
+TEST(Deserializer, small_int_runs) {
+  std::vector<uint32_t> uints;
+  std::vector<int16_t> ints;
+  for (int i = 0; i < 1000; i++) {
+    // runs of single-byte values broken up by wider ones
+    uints.push_back(i % 37 == 0 ? 100000 + i : i % 128);
+    ints.push_back(int16_t(i % 50 == 0 ? -3000 : i % 64 - 32));
+  }
+  Serializer s;
+  serialize(s, uints);
+  serialize(s, ints);
+  auto data = s.take();
+
+  Deserializer d{.buffer = data};
+  std::vector<uint32_t> loaded_uints;
+  std::vector<int16_t> loaded_ints;
+  deserialize(d, loaded_uints);
+  deserialize(d, loaded_ints);
+  ASSERT_TRUE(d.status());
+  ASSERT_EQ(loaded_uints, uints);
+  ASSERT_EQ(loaded_ints, ints);
+}
+
+TEST(Serializer, block_vectors) {
+  std::vector<test::Point> points;
+  for (int i = 0; i < 1000; i++) {
+    points.push_back({uint64_t(i) << 33, uint32_t(i), -i});
+  }
+  Serializer s({.gather_threshold = 1024});
+  serialize(s, points);
+  // the count, then the vector's own bytes
+  auto pieces = s.iovecs();
+  ASSERT_EQ(pieces.size(), 2);
+  ASSERT_EQ(pieces[1].iov_base, points.data());
+  ASSERT_EQ(s.size(), buffered_size(points));
+
+  auto data = s.take();
+  Deserializer d{.buffer = data};
+  std::vector<test::Point> loaded;
+  deserialize(d, loaded);
+  ASSERT_TRUE(d.status());
+  ASSERT_EQ(loaded, points);
+
+  Deserializer truncated{.buffer = std::string_view(data).substr(0, 100)};
+  deserialize(truncated, loaded);
+  ASSERT_FALSE(truncated.status());
+  ASSERT_TRUE(loaded.empty());
+}
+
+TEST(Serializer, delta_columns) {
+  DeltaColumn<uint64_t> sorted;
+  for (uint64_t i = 0; i < 1000; i++) {
+    sorted.values_.push_back((uint64_t(1) << 40) + i * 1000);
+  }
+  DeltaColumn<uint16_t> unsorted{.values_ = {5, 3, 65535, 0, 7}};
+  Serializer s;
+  serialize(s, sorted);
+  // a 9 byte first value, the rest 3 bytes each instead of 9
+  ASSERT_EQ(s.size(), 3 + 9 + 999 * 3);
+  serialize(s, unsorted);
+  auto data = s.take();
+
+  Deserializer d{.buffer = data};
+  DeltaColumn<uint64_t> loaded_sorted;
+  DeltaColumn<uint16_t> loaded_unsorted;
+  deserialize(d, loaded_sorted);
+  deserialize(d, loaded_unsorted);
+  ASSERT_TRUE(d.status());
+  ASSERT_EQ(loaded_sorted.values_, sorted.values_);
+  ASSERT_EQ(loaded_unsorted.values_, unsorted.values_);
+}
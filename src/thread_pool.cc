@@ -0,0 +1,93 @@
+#include "thread_pool.hh"
+
+namespace oned {
+
+// the pool and worker index of the calling thread, if it is a worker
+static thread_local const ThreadPool *current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+ThreadPool::ThreadPool(size_t threads) {
+  workers_.reserve(std::max<size_t>(threads, 1));
+  for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < workers_.size(); i++) {
+    workers_[i]->thread_ = std::thread([this, i] { run(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker->thread_.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  size_t target = 0;
+  if (current_pool == this) {
+    target = current_worker;
+  } else {
+    std::lock_guard lock(mutex_);
+    target = next_++ % workers_.size();
+  }
+  {
+    auto &worker = *workers_[target];
+    std::lock_guard lock(worker.mutex_);
+    worker.tasks_.push_back(std::move(task));
+  }
+  {
+    std::lock_guard lock(mutex_);
+    queued_++;
+  }
+  cv_.notify_one();
+}
+
+bool ThreadPool::pop(size_t self, std::function<void()> &task) {
+  {
+    auto &own = *workers_[self];
+    std::lock_guard lock(own.mutex_);
+    if (!own.tasks_.empty()) {
+      task = std::move(own.tasks_.front());
+      own.tasks_.pop_front();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers_.size(); i++) {
+    auto &victim = *workers_[(self + i) % workers_.size()];
+    std::lock_guard lock(victim.mutex_);
+    if (!victim.tasks_.empty()) {
+      task = std::move(victim.tasks_.back());
+      victim.tasks_.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(size_t self) {
+  current_pool = this;
+  current_worker = self;
+  while (true) {
+    {
+      std::unique_lock lock(mutex_);
+      cv_.wait(lock, [this] { return queued_ != 0 || stop_; });
+      if (queued_ == 0) {
+        return;
+      }
+      // claims one of the queued tasks, whichever queue it sits in
+      queued_--;
+    }
+    std::function<void()> task;
+    while (!pop(self, task)) {
+      std::this_thread::yield();
+    }
+    task();
+  }
+}
+
+}  // namespace oned
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "noncopyable.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace oned {
+
+// Fixed set of workers, each with its own task queue. A worker runs its own
+// tasks in submission order and steals from the back of the others' queues
+// when it runs dry, so one long task does not hold up the rest.
+class ThreadPool : NonCopyable {
+public:
+  explicit ThreadPool(
+      size_t threads = std::max(std::thread::hardware_concurrency(), 1U));
+
+  ThreadPool(ThreadPool &&) = delete;
+  ThreadPool &operator=(ThreadPool &&) = delete;
+  // Runs whatever is still queued, then joins.
+  ~ThreadPool();
+
+  // Tasks submitted from a worker go to that worker's queue, others are
+  // spread round-robin.
+  void submit(std::function<void()> task);
+
+  size_t size() const {
+    return workers_.size();
+  }
+
+private:
+  struct alignas(64) Worker {
+    std::mutex mutex_;
+    std::deque<std::function<void()>> tasks_;
+    std::thread thread_;
+  };
+
+  void run(size_t self);
+  bool pop(size_t self, std::function<void()> &task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // guards sleeping and waking, the queues have their own locks
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t queued_ = 0;
+  size_t next_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace oned
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace oned {
+
+// Sequence container backed by an implicit treap. Every node caches the
+// element count and the summed `Weight` of its subtree, so positional
+// access, lookup by accumulated weight, insert and erase are all
+// O(log n). Any modification invalidates iterators, as with std::vector.
+//
+// share() returns an O(1) copy that shares every node. A modification
+// copies the nodes on its path that are older than the last share() and
+// updates newer ones in place, leaving every other copy as it was. A copy
+// can be read on another thread while the original is modified. There is
+// no copy constructor, as copying has to write to the source.
+template <typename T, typename Weight>
+class WeightedTree {
+  // a copy starts with no references of its own
+  struct Node : boost::intrusive_ref_counter<Node, boost::thread_safe_counter> {
+    T value_;
+    uint64_t weight_{};
+    size_t count_{1};
+    uint32_t priority_{};
+    // the epoch of the tree that created it
+    uint64_t epoch_{};
+    boost::intrusive_ptr<Node> left_;
+    boost::intrusive_ptr<Node> right_;
+
+    Node(T value, uint32_t priority, uint64_t epoch)
+        : value_(std::move(value)), priority_(priority), epoch_(epoch) {
+      weight_ = Weight{}(value_);
+    }
+  };
+  using NodePtr = boost::intrusive_ptr<Node>;
+
+public:
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    const_iterator() = default;
+
+    reference operator*() const {
+      return stack_.back()->value_;
+    }
+    pointer operator->() const {
+      return &stack_.back()->value_;
+    }
+
+    const_iterator &operator++() {
+      const Node *node = stack_.back();
+      stack_.pop_back();
+      for (node = node->right_.get(); node; node = node->left_.get()) {
+        stack_.push_back(node);
+      }
+      index_++;
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      auto ret = *this;
+      ++*this;
+      return ret;
+    }
+
+    // position in the sequence, end() is size()
+    size_t index() const {
+      return index_;
+    }
+
+    bool operator==(const const_iterator &other) const {
+      return index_ == other.index_;
+    }
+
+  private:
+    friend class WeightedTree;
+
+    size_t index_ = 0;
+    // the current node on top, below it every ancestor whose left subtree
+    // holds the current node
+    std::vector<const Node *> stack_;
+  };
+  using iterator = const_iterator;
+
+  WeightedTree() = default;
+
+  WeightedTree(const WeightedTree &) = delete;
+  WeightedTree(WeightedTree &&) noexcept = default;
+  WeightedTree &operator=(const WeightedTree &) = delete;
+  WeightedTree &operator=(WeightedTree &&other) noexcept {
+    if (this != &other) {
+      clear();
+      root_ = std::move(other.root_);
+      seed_ = other.seed_;
+      epoch_ = other.epoch_;
+    }
+    return *this;
+  }
+
+  ~WeightedTree() {
+    clear();
+  }
+
+  // Both move on to a new epoch, every node there is now is shared.
+  WeightedTree share() {
+    WeightedTree ret;
+    ret.root_ = root_;
+    ret.seed_ = seed_;
+    ret.epoch_ = ++epoch_;
+    return ret;
+  }
+
+  size_t size() const {
+    return count(root_.get());
+  }
+  bool empty() const {
+    return root_ == nullptr;
+  }
+  uint64_t weight() const {
+    return weight(root_.get());
+  }
+
+  void clear() {
+    // unlink iteratively so a degenerate tree cannot overflow the stack,
+    // shared nodes are only released
+    std::vector<NodePtr> pending;
+    if (root_) {
+      pending.push_back(std::move(root_));
+    }
+    while (!pending.empty()) {
+      auto node = std::move(pending.back());
+      pending.pop_back();
+      if (node->epoch_ != epoch_) {
+        continue;
+      }
+      if (node->left_) {
+        pending.push_back(std::move(node->left_));
+      }
+      if (node->right_) {
+        pending.push_back(std::move(node->right_));
+      }
+    }
+  }
+
+  const_iterator begin() const {
+    return at(0);
+  }
+  const_iterator end() const {
+    const_iterator iter;
+    iter.index_ = size();
+    return iter;
+  }
+
+  const T &operator[](size_t index) const {
+    assert(index < size());
+    return *at(index);
+  }
+
+  // Iterator to the element at `index`, or end().
+  const_iterator at(size_t index) const {
+    const_iterator iter;
+    iter.index_ = index;
+    const Node *node = root_.get();
+    while (node) {
+      auto left = count(node->left_.get());
+      if (index < left) {
+        iter.stack_.push_back(node);
+        node = node->left_.get();
+      } else if (index == left) {
+        iter.stack_.push_back(node);
+        return iter;
+      } else {
+        index -= left + 1;
+        node = node->right_.get();
+      }
+    }
+    return end();
+  }
+
+  // The element covering accumulated weight `offset` together with the
+  // weight in front of it. Past the end returns (weight(), end()).
+  std::pair<uint64_t, const_iterator> find(uint64_t offset) const {
+    const_iterator iter;
+    uint64_t start = 0;
+    size_t index = 0;
+    const Node *node = root_.get();
+    while (node) {
+      auto left = weight(node->left_.get());
+      auto own = node->weight_ - left - weight(node->right_.get());
+      if (offset < left) {
+        iter.stack_.push_back(node);
+        node = node->left_.get();
+      } else if (offset < left + own) {
+        iter.stack_.push_back(node);
+        iter.index_ = index + count(node->left_.get());
+        return std::make_pair(start + left, iter);
+      } else {
+        offset -= left + own;
+        start += left + own;
+        index += count(node->left_.get()) + 1;
+        node = node->right_.get();
+      }
+    }
+    return std::make_pair(weight(), end());
+  }
+
+  void push_back(T value) {
+    root_ = merge(std::move(root_), make_node(std::move(value)));
+  }
+
+  iterator insert(const_iterator pos, T value) {
+    auto index = pos.index_;
+    auto [left, right] = split(std::move(root_), index);
+    root_ = merge(merge(std::move(left), make_node(std::move(value))),
+                  std::move(right));
+    return at(index);
+  }
+
+  template <typename It>
+  iterator insert(const_iterator pos, It first, It last) {
+    auto index = pos.index_;
+    NodePtr middle;
+    for (; first != last; ++first) {
+      middle = merge(std::move(middle), make_node(*first));
+    }
+    auto [left, right] = split(std::move(root_), index);
+    root_ = merge(merge(std::move(left), std::move(middle)), std::move(right));
+    return at(index);
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    auto index = first.index_;
+    assert(index <= last.index_);
+    auto [left, rest] = split(std::move(root_), index);
+    auto [middle, right] = split(std::move(rest), last.index_ - index);
+    WeightedTree dropped;
+    dropped.root_ = std::move(middle);
+    dropped.epoch_ = epoch_;
+    root_ = merge(std::move(left), std::move(right));
+    return at(index);
+  }
+
+  iterator erase(const_iterator pos) {
+    auto next = pos;
+    next.index_++;
+    return erase(pos, next);
+  }
+
+  // Overwrite the element at `pos`, refreshing the cached weights.
+  void replace(const_iterator pos, T value) {
+    auto index = pos.index_;
+    NodePtr *slot = &root_;
+    Node *node = nullptr;
+    std::vector<Node *> path;
+    while (*slot) {
+      node = own(*slot);
+      path.push_back(node);
+      auto left = count(node->left_.get());
+      if (index < left) {
+        slot = &node->left_;
+      } else if (index == left) {
+        break;
+      } else {
+        index -= left + 1;
+        slot = &node->right_;
+      }
+    }
+    assert(*slot);
+    node->value_ = std::move(value);
+    for (auto iter = path.rbegin(); iter != path.rend(); iter++) {
+      update(*iter);
+    }
+  }
+
+private:
+  static size_t count(const Node *node) {
+    return node ? node->count_ : 0;
+  }
+  static uint64_t weight(const Node *node) {
+    return node ? node->weight_ : 0;
+  }
+
+  static void update(Node *node) {
+    node->count_ = 1 + count(node->left_.get()) + count(node->right_.get());
+    node->weight_ = Weight{}(node->value_) + weight(node->left_.get()) +
+                    weight(node->right_.get());
+  }
+
+  // `node` itself, or a copy of it when it may be shared. Only checks
+  // the epoch, never the reference count, which copies on other threads
+  // change.
+  Node *own(NodePtr &node) const {
+    if (node->epoch_ != epoch_) {
+      node = new Node(*node);
+      node->epoch_ = epoch_;
+    }
+    return node.get();
+  }
+
+  NodePtr make_node(T value) {
+    // xorshift32, good enough to keep the treap balanced
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return new Node(std::move(value), seed_, epoch_);
+  }
+
+  // first `index` elements go left, the rest right
+  std::pair<NodePtr, NodePtr> split(NodePtr node, size_t index) const {
+    if (!node) {
+      return {};
+    }
+    own(node);
+    auto left = count(node->left_.get());
+    if (index <= left) {
+      auto [l, r] = split(std::move(node->left_), index);
+      node->left_ = std::move(r);
+      update(node.get());
+      return std::make_pair(std::move(l), std::move(node));
+    }
+    auto [l, r] = split(std::move(node->right_), index - left - 1);
+    node->right_ = std::move(l);
+    update(node.get());
+    return std::make_pair(std::move(node), std::move(r));
+  }
+
+  NodePtr merge(NodePtr left, NodePtr right) const {
+    if (!left) {
+      return right;
+    }
+    if (!right) {
+      return left;
+    }
+    if (left->priority_ > right->priority_) {
+      own(left);
+      left->right_ = merge(std::move(left->right_), std::move(right));
+      update(left.get());
+      return left;
+    }
+    own(right);
+    right->left_ = merge(std::move(left), std::move(right->left_));
+    update(right.get());
+    return right;
+  }
+
+  NodePtr root_;
+  uint32_t seed_ = 2463534242U;
+  // bumped by every share(), nodes of the current epoch belong to this
+  // tree alone
+  uint64_t epoch_ = 0;
+};
+
+}  // namespace oned